@@ -1,34 +1,132 @@
 #include <pebble.h>
-
-#ifdef PBL_SDK_2
 #include "action_menu.h"
 
+// Heap functions used for every allocation of the library. They can be
+// overridden at build time (all four together), e.g. by a host harness
+// tracking allocations and injecting failures.
+#ifndef ACTION_MENU_MALLOC
+#define ACTION_MENU_MALLOC  malloc
+#define ACTION_MENU_CALLOC  calloc
+#define ACTION_MENU_REALLOC realloc
+#define ACTION_MENU_FREE    free
+#endif
+
+#if ACTION_MENU_STATS
+// Number of heap operations of the library, the SDK objects it creates and
+// destroys included, an input of ActionMenuSessionStats
+static uint32_t s_heap_operations;
+#define COUNT_HEAP_OPERATIONS(n) (s_heap_operations += (n))
+#else
+#define COUNT_HEAP_OPERATIONS(n)
+#endif
+
+static void *heap_malloc(size_t size) {
+  COUNT_HEAP_OPERATIONS(1);
+  return ACTION_MENU_MALLOC(size);
+}
+
+static void *heap_calloc(size_t count, size_t size) {
+  COUNT_HEAP_OPERATIONS(1);
+  return ACTION_MENU_CALLOC(count, size);
+}
+
+static void *heap_realloc(void *ptr, size_t size) {
+  COUNT_HEAP_OPERATIONS(1);
+  return ACTION_MENU_REALLOC(ptr, size);
+}
+
+static void heap_free(void *ptr) {
+  if(ptr) {
+    COUNT_HEAP_OPERATIONS(1);
+  }
+  ACTION_MENU_FREE(ptr);
+}
+
 #define ACTION_MENU_FONT_SMALL  FONT_KEY_GOTHIC_18_BOLD
 #define ACTION_MENU_FONT_NORMAL FONT_KEY_GOTHIC_24_BOLD
 #define ACTION_MENU_FONT_BIG    FONT_KEY_GOTHIC_28_BOLD
 
-// Choose you favourite font size
+// Choose you favourite font size (used when the config doesn't select a font)
 #define ACTION_MENU_FONT ACTION_MENU_FONT_NORMAL
 
+// Number of custom fonts kept loaded at the same time
+#define FONT_CACHE_SIZE 2
+
+#define ITEM_FLAG_COMPACT     0x01
+#define ITEM_FLAG_INLINE_DATA 0x02
+#define ITEM_FLAG_PLAIN_LABEL 0x04
+
 struct ActionMenuItem {
   char *label;
+  const ActionMenuLevel *child;
+  uint8_t flags;
+
+  // Not allocated for compact items, which rely on the level default action
   void *action_data;
   ActionMenuPerformActionCb cb;
+  ActionMenuPerformActionCb long_press_cb;
 
-  const ActionMenuLevel *child;
+  // Followed by the inline action data, if any
 };
 
+#define COMPACT_ITEM_SIZE offsetof(ActionMenuItem, action_data)
+
+// Measurements of the cells and section headers of a level, kept with the
+// level so that showing it again measures nothing. They are only valid for
+// the fonts, width and measure callback they were made with: custom fonts are
+// told apart by their load number, as a reloaded font may get the address of
+// an unloaded one. The arrays
+// follow the struct in the same block, 2 bytes per item. Only the levels
+// shown by open menus and their ancestors keep their cache.
+typedef struct {
+  GFont     font;
+  uint32_t  font_load;
+  GFont     header_font;
+  int16_t   width;
+  ActionMenuMeasureItemCb measure;
+  bool      valid;
+  uint16_t  num_cells;
+  uint16_t  num_headers;
+  int16_t   *cell_heights;   // 0 until measured
+  int16_t   *header_heights; // 0 until measured
+} LevelCache;
+
+// Header starting a group of consecutive items within a level
+typedef struct {
+  uint16_t first_item;
+  char     *label;
+} ActionMenuSection;
+
 struct ActionMenuLevel {
   uint16_t         max_items;
   uint16_t         num_items;
   ActionMenuItem** items;
   ActionMenuLevelDisplayMode display_mode;
+  ActionMenuPerformIndexedActionCb default_cb;
+  uint8_t          inline_data_size;
+
+  uint16_t           num_sections;
+  ActionMenuSection* sections;
+
+  // Strided levels have no items: they view an array owned by the app
+  const uint8_t*            strided_base;
+  size_t                    stride;
+  size_t                    label_offset;
+  ActionMenuPerformActionCb strided_cb;
+
+  // Multi-select mode: one bit per item, set when the item is selected
+  uint8_t*                selection;
+  const ActionMenuItem*   confirm_item;
+  ActionMenuMultiSelectCb confirm_cb;
+
+  LevelCache*      cache;
 
   uint16_t        level;
   const ActionMenuLevel *parent;
 };
 
 struct ActionMenu {
+  ActionMenu            *next_open; // list of the open ActionMenus
   const ActionMenuLevel *current_level;
   const ActionMenuLevel *tmp_level;
   const ActionMenuItem  *performed_action;
@@ -36,6 +134,42 @@ struct ActionMenu {
   ActionMenuConfig *config;
   Window        *result_window;
   bool          frozen;
+  bool          visible;
+  bool          closing;
+  bool          will_close_sent;
+  bool          refresh_pending;
+  bool          reset_selection_pending;
+
+#if ACTION_MENU_STATS
+  // Latency measurement, see ActionMenuStats
+  uint32_t      press_time;
+  uint32_t      back_time;
+  bool          redraw_pending;
+  bool          back_pending;
+
+  ActionMenuSessionStats session;
+  uint32_t      heap_operations_at_open;
+  uint32_t      visible_since;
+#endif
+
+  GFont         font;
+  uint32_t      font_load; // load number of a custom font, 0 for system fonts
+  GFont         header_font;
+
+  // Geometry derived from the window bounds in load_cb
+  struct {
+    int16_t        cell_width;
+    int16_t        cell_inset;     // extra horizontal inset of the cells
+    int16_t        text_width;     // width available to the labels
+    int16_t        text_max_height;
+    int16_t        arrow_x;
+    GTextAlignment text_alignment;
+  } layout;
+
+  // Items standing for the elements of a strided level, one being drawn and
+  // one for the action performed, which must outlive the next redraw
+  ActionMenuItem cell_item;
+  ActionMenuItem action_item;
 
   Window        *window;
   Layer         *bg_layer;
@@ -45,15 +179,304 @@ struct ActionMenu {
   PropertyAnimation *prop_animation;
 };
 
+typedef struct {
+  uint32_t resource_id;
+  GFont    font;
+  uint32_t load; // number of the load of this font, see s_font_loads
+  uint8_t  ref_count;
+} FontCacheEntry;
+
+static FontCacheEntry s_font_cache[FONT_CACHE_SIZE];
+static uint32_t s_font_loads;
+
+static ActionMenu *s_open_menus;
+
+#if ACTION_MENU_STATS
+#define SLOW_CALLBACK_DEFAULT_THRESHOLD_MS 100
+
+static ActionMenuStats s_stats;
+static uint16_t s_slow_callback_threshold = SLOW_CALLBACK_DEFAULT_THRESHOLD_MS;
+#endif
+
+typedef struct {
+  uint64_t       key;
+  uint16_t       index; // index of the item before sorting
+  bool           selected;
+  ActionMenuItem *item;
+} SortEntry;
+
 static const uint8_t ARROW_IMAGE_DATA[] = {0x04, 0x00, 0x00, 0x10, 0x00, 0x00, 0x00, 0x00, 0x07, 0x00, 0x05, 0x00, 0x1b, 0x00, 0x00, 0x00, 0x36, 0x00, 0x00, 0x00, 0x6c, 0x00, 0x00, 0x00, 0x36, 0x00, 0x00, 0x00, 0x1b, 0x00, 0x00, 0x00};
 
 #define MENU_LAYER_OFFSET 14
 
+// Horizontal margin and padding of a cell around its label
+#define CELL_MARGIN  4
+#define CELL_PADDING 4
+
+// Keeps the cells clear of the bezel on round screens
+#ifdef PBL_ROUND
+#define ROUND_CELL_INSET 14
+#else
+#define ROUND_CELL_INSET 0
+#endif
+
+// Compressed labels: bytes in [LABEL_CODE_FIRST, LABEL_CODE_FIRST + LABEL_DICT_MAX_WORDS)
+// stand for the matching entry of the label dictionary
+#define LABEL_CODE_FIRST      0x10
+#define LABEL_DICT_MAX_WORDS  16
+
+// Size of the buffer compressed labels are decoded into (longer labels are truncated)
+#define LABEL_SCRATCH_SIZE    128
+
+static const char *const *s_label_dict;
+static uint8_t s_label_dict_size;
+static char s_label_scratch[LABEL_SCRATCH_SIZE];
+// Number of labels stored by label_store_create and not destroyed yet
+static uint16_t s_num_stored_labels;
+
+static bool label_is_code(char c) {
+  return (uint8_t)c >= LABEL_CODE_FIRST && (uint8_t)c < LABEL_CODE_FIRST + s_label_dict_size;
+}
+
+//! Encode a label with the label dictionary, greedily replacing the longest
+//! matching dictionary word at each position
+//! @param out the destination buffer, NULL to only compute the encoded length
+//! @return the length of the encoded label, without the terminating NUL
+static size_t label_encode(const char *label, char *out) {
+  size_t len = 0;
+  while(*label) {
+    uint8_t best = 0;
+    size_t best_len = 1;
+    for(uint8_t i=0; i<s_label_dict_size; i++) {
+      size_t word_len = strlen(s_label_dict[i]);
+      if(word_len > best_len && strncmp(label, s_label_dict[i], word_len) == 0) {
+        best = LABEL_CODE_FIRST + i;
+        best_len = word_len;
+      }
+    }
+    if(out) {
+      out[len] = best ? (char)best : *label;
+    }
+    len++;
+    label += best_len;
+  }
+  if(out) {
+    out[len] = 0;
+  }
+  return len;
+}
+
+//! Copy a label into a new heap block, compressed if a label dictionary is set
+//! @return the stored label, NULL if out of memory or if the label contains
+//! bytes reserved for the dictionary codes while a dictionary is set
+static char *label_store_create(const char *label) {
+  if(s_label_dict_size) {
+    for(const char *c = label; *c; c++) {
+      if((uint8_t)*c >= LABEL_CODE_FIRST && (uint8_t)*c < LABEL_CODE_FIRST + LABEL_DICT_MAX_WORDS)
+        return NULL;
+    }
+  }
+
+  char *stored = heap_malloc(label_encode(label, NULL) + 1);
+  if(stored) {
+    label_encode(label, stored);
+    s_num_stored_labels++;
+  }
+  return stored;
+}
+
+static void label_store_destroy(char *stored) {
+  if(stored) {
+    s_num_stored_labels--;
+    heap_free(stored);
+  }
+}
+
+//! Decode a stored label
+//! @return the label itself when no dictionary is set, otherwise the label
+//! decoded into the shared scratch buffer, valid until the next decode
+static const char *label_decode(const char *stored) {
+  if(stored == NULL || s_label_dict_size == 0) {
+    return stored;
+  }
+
+  size_t len = 0;
+  for(const char *c = stored; *c && len < LABEL_SCRATCH_SIZE - 1; c++) {
+    if(label_is_code(*c)) {
+      for(const char *w = s_label_dict[(uint8_t)*c - LABEL_CODE_FIRST]; *w && len < LABEL_SCRATCH_SIZE - 1; w++) {
+        s_label_scratch[len++] = *w;
+      }
+    }
+    else {
+      s_label_scratch[len++] = *c;
+    }
+  }
+  s_label_scratch[len] = 0;
+  return s_label_scratch;
+}
+
+//! Get the label of an item as displayed. Labels of strided levels belong to
+//! the app and were never encoded, so they are returned as is.
+static const char *item_label(const ActionMenuItem *item) {
+  return item->flags & ITEM_FLAG_PLAIN_LABEL ? item->label : label_decode(item->label);
+}
+
+//! Set the dictionary used to compress the labels of the items added afterwards.
+//! Labels are stored with each occurrence of a dictionary word replaced by a single
+//! byte and decoded into a shared scratch buffer when drawn or requested.
+//! Decoded labels are truncated to 127 characters, labels of strided levels are
+//! never encoded nor truncated.
+//! @param words the dictionary words, e.g. the most frequent words of the label corpus
+//! built by a host tool. The array must stay valid as long as any level exists.
+//! @param num_words the number of words, at most 16. Pass 0 to disable compression.
+//! @return true on success, false if labels are stored: the dictionary can only change
+//! before any label is added or once every hierarchy is destroyed
+//! @note labels containing the bytes 0x10-0x1F are refused while a dictionary is set
+bool action_menu_set_label_dictionary(const char *const *words, uint8_t num_words){
+  // Stored labels would decode with the wrong words
+  if(s_num_stored_labels)
+    return false;
+
+  s_label_dict = words;
+  s_label_dict_size = words == NULL ? 0 :
+                      num_words > LABEL_DICT_MAX_WORDS ? LABEL_DICT_MAX_WORDS : num_words;
+  return true;
+}
+
+//! Get a custom font from the shared cache, loading it if needed.
+//! Unused fonts are evicted to make room for it.
+//! @param load set to the load number of the font, which identifies it even
+//! when it gets the address of a font unloaded before
+//! @return the font, NULL if it could not be loaded
+static GFont font_cache_acquire(uint32_t resource_id, uint32_t *load) {
+  FontCacheEntry *slot = NULL;
+  for(uint8_t i=0; i<FONT_CACHE_SIZE; i++) {
+    FontCacheEntry *entry = &s_font_cache[i];
+    if(entry->font && entry->resource_id == resource_id) {
+      entry->ref_count++;
+      *load = entry->load;
+      return entry->font;
+    }
+    if(entry->ref_count == 0 && (slot == NULL || slot->font)) {
+      slot = entry;
+    }
+  }
+
+  if(slot == NULL) {
+    return NULL;
+  }
+
+  if(slot->font) {
+    fonts_unload_custom_font(slot->font);
+    COUNT_HEAP_OPERATIONS(1);
+  }
+  slot->resource_id = resource_id;
+  slot->font = fonts_load_custom_font(resource_get_handle(resource_id));
+  COUNT_HEAP_OPERATIONS(1);
+  slot->load = ++s_font_loads;
+  slot->ref_count = slot->font ? 1 : 0;
+  *load = slot->load;
+  return slot->font;
+}
+
+//! Release a font obtained from \ref font_cache_acquire. The font stays
+//! loaded for the next menu until it is evicted or trimmed.
+static void font_cache_release(GFont font) {
+  for(uint8_t i=0; i<FONT_CACHE_SIZE; i++) {
+    if(font && s_font_cache[i].font == font && s_font_cache[i].ref_count) {
+      s_font_cache[i].ref_count--;
+      return;
+    }
+  }
+}
+
+//! Unload the cached custom fonts which are not used by an open ActionMenu.
+//! @note call this when the app is running low on memory
+void action_menu_font_cache_trim(void){
+  for(uint8_t i=0; i<FONT_CACHE_SIZE; i++) {
+    FontCacheEntry *entry = &s_font_cache[i];
+    if(entry->font && entry->ref_count == 0) {
+      fonts_unload_custom_font(entry->font);
+      COUNT_HEAP_OPERATIONS(1);
+      entry->font = NULL;
+    }
+  }
+}
+
+#if ACTION_MENU_STATS
+static uint32_t now_ms(void) {
+  time_t seconds;
+  uint16_t milliseconds;
+  time_ms(&seconds, &milliseconds);
+  return (uint32_t)seconds * 1000 + milliseconds;
+}
+
+static void latency_record(ActionMenuLatencyHistogram *histogram, uint32_t start) {
+  uint32_t elapsed = now_ms() - start;
+  uint8_t bucket = 0;
+  while(bucket < ACTION_MENU_LATENCY_BUCKETS - 1 && elapsed >= (16u << bucket)) {
+    bucket++;
+  }
+  if(histogram->buckets[bucket] < UINT16_MAX) {
+    histogram->buckets[bucket]++;
+  }
+}
+
+//! Report the user callbacks which blocked the event loop for too long
+//! @param start the time the callback was called at, from now_ms
+//! @param name the callback name for the log
+static void callback_done(uint32_t start, const char *name) {
+  uint32_t elapsed = now_ms() - start;
+  if(elapsed > s_stats.slowest_callback_ms) {
+    s_stats.slowest_callback_ms = elapsed > UINT16_MAX ? UINT16_MAX : elapsed;
+  }
+  if(s_slow_callback_threshold && elapsed >= s_slow_callback_threshold) {
+    if(s_stats.slow_callbacks < UINT16_MAX) {
+      s_stats.slow_callbacks++;
+    }
+    APP_LOG(APP_LOG_LEVEL_WARNING, "ActionMenu: %s callback took %d ms", name, (int)elapsed);
+  }
+}
+
+//! Get the latency statistics gathered by every ActionMenu since the app started
+//! or since the last \ref action_menu_reset_stats
+//! @return the statistics
+const ActionMenuStats *action_menu_get_stats(void){
+  return &s_stats;
+}
+
+//! Clear the latency statistics
+void action_menu_reset_stats(void){
+  memset(&s_stats, 0, sizeof(ActionMenuStats));
+}
+
+//! Set the duration above which a user callback called by the ActionMenu is
+//! logged as a warning and counted in \ref ActionMenuStats.
+//! @param threshold_ms the threshold in milliseconds (100 by default), 0 to disable the warnings
+void action_menu_set_slow_callback_threshold(uint16_t threshold_ms){
+  s_slow_callback_threshold = threshold_ms;
+}
+
+// Time the user callbacks and the latencies and count the work of the
+// sessions, compiled out with the statistics
+#define CALLBACK_START(start) uint32_t start = now_ms()
+#define CALLBACK_DONE(start, name) callback_done(start, name)
+#define LATENCY_RECORD(histogram, start) latency_record(&s_stats.histogram, start)
+#define SESSION_COUNT(menu, counter) ((menu)->session.counter++)
+#else
+#define CALLBACK_START(start)
+#define CALLBACK_DONE(start, name)
+#define LATENCY_RECORD(histogram, start)
+#define SESSION_COUNT(menu, counter)
+#endif
+
 //! Getter for the label of a given \ref ActionMenuItem
 //! @param item the \ref ActionMenuItem of interest
 //! @return a pointer to the string label. NULL if invalid.
+//! @note when a label dictionary is set, the label of an item added to a level is
+//! decoded into a shared buffer which is only valid until the next call
 char *action_menu_item_get_label(const ActionMenuItem *item) {
-  return item ? item->label : NULL;
+  return item ? (char *)item_label(item) : NULL;
 }
 
 //! Getter for the action_data pointer of a given \ref ActionMenuitem.
@@ -61,7 +484,21 @@ char *action_menu_item_get_label(const ActionMenuItem *item) {
 //! @param item the \ref ActionMenuItem of interest
 //! @return a pointer to the data. NULL if invalid.
 void *action_menu_item_get_action_data(const ActionMenuItem *item){
-  return item ? item->action_data : NULL;
+  if(item == NULL)
+    return NULL;
+
+  if(item->flags & ITEM_FLAG_INLINE_DATA)
+    return (uint8_t *)item + (item->flags & ITEM_FLAG_COMPACT ? COMPACT_ITEM_SIZE : sizeof(ActionMenuItem));
+
+  return item->flags & ITEM_FLAG_COMPACT ? NULL : item->action_data;
+}
+
+static ActionMenuPerformActionCb item_get_cb(const ActionMenuItem *item) {
+  return item->flags & ITEM_FLAG_COMPACT ? NULL : item->cb;
+}
+
+static ActionMenuPerformActionCb item_get_long_press_cb(const ActionMenuItem *item) {
+  return item->flags & ITEM_FLAG_COMPACT ? NULL : item->long_press_cb;
 }
 
 //! Create a new action menu level with storage allocated for a given number of items
@@ -71,16 +508,16 @@ void *action_menu_item_get_action_data(const ActionMenuItem *item){
 //! Use \ref action_menu_level_set_display_mode to change it.
 //! @see action_menu_hierarchy_destroy
 ActionMenuLevel *action_menu_level_create(uint16_t num_items){
-  ActionMenuLevel* level = malloc(sizeof(ActionMenuLevel));
+  ActionMenuLevel* level = heap_malloc(sizeof(ActionMenuLevel));
   if(level) {
     memset(level, 0, sizeof(ActionMenuLevel));
     level->display_mode = ActionMenuLevelDisplayModeWide;
     level->num_items = 0;
     level->max_items = num_items;
     level->level = 1;
-    level->items = malloc(num_items * sizeof(ActionMenuItem*));
+    level->items = heap_malloc(num_items * sizeof(ActionMenuItem*));
     if(level->items == NULL){
-      free(level);
+      heap_free(level);
       level = NULL;
     }
     else {
@@ -91,6 +528,54 @@ ActionMenuLevel *action_menu_level_create(uint16_t num_items){
   return level;
 }
 
+//! Create a level displaying the elements of an array owned by the app, without
+//! allocating any \ref ActionMenuItem or label
+//! @param base the first element of the array
+//! @param count the number of elements
+//! @param stride the size of an element, i.e. sizeof the element struct
+//! @param label_offset the offset of the label in an element, which must be a NUL
+//! terminated char array member, e.g. offsetof(Contact, name)
+//! @param cb the callback triggered when any element is actuated. The \ref ActionMenuItem
+//! it receives has the label of the element and the element as action_data.
+//! @note the array must not change while the level exists
+//! @see action_menu_level_create
+ActionMenuLevel *action_menu_level_create_strided(const void *base,
+                                                  uint16_t count,
+                                                  size_t stride,
+                                                  size_t label_offset,
+                                                  ActionMenuPerformActionCb cb){
+  ActionMenuLevel* level = heap_malloc(sizeof(ActionMenuLevel));
+  if(level) {
+    memset(level, 0, sizeof(ActionMenuLevel));
+    level->display_mode = ActionMenuLevelDisplayModeWide;
+    level->num_items = count;
+    level->max_items = count;
+    level->level = 1;
+    level->strided_base = base;
+    level->stride = stride;
+    level->label_offset = label_offset;
+    level->strided_cb = cb;
+  }
+  return level;
+}
+
+//! Get an item of a level
+//! @param scratch storage for the item standing for an element of a strided level
+//! @return the item, either owned by the level or scratch
+static const ActionMenuItem *level_get_item(const ActionMenuLevel *level, uint16_t index, ActionMenuItem *scratch) {
+  if(level->strided_base == NULL) {
+    return level->items[index];
+  }
+
+  const uint8_t *element = level->strided_base + index * level->stride;
+  memset(scratch, 0, sizeof(ActionMenuItem));
+  scratch->label = (char *)(element + level->label_offset);
+  scratch->action_data = (void *)element;
+  scratch->cb = level->strided_cb;
+  scratch->flags = ITEM_FLAG_PLAIN_LABEL;
+  return scratch;
+}
+
 //! Set the action menu display mode
 //! @param level The ActionMenuLevel whose display mode you want to change
 //! @param display_mode The display mode for the action menu (3 vs. 1 item per row)
@@ -101,32 +586,29 @@ void action_menu_level_set_display_mode(ActionMenuLevel *level,
   }
 }
 
-//! Add an action to an ActionLevel
-//! @param level the level to add the action to
-//! @param label the text to display for the action in the menu
-//! @param cb the callback that will be triggered when this action is actuated
-//! @param action_data data to pass to the callback for this action
-//! @return a reference to the new \ref ActionMenuItem on success, NULL if the level is full
-ActionMenuItem *action_menu_level_add_action(ActionMenuLevel *level,
-                                             const char *label,
-                                             ActionMenuPerformActionCb cb,
-                                             void *action_data){
+//! Allocate an item with a copy of its label and append it to a level
+//! @param size the size of the item, sizeof(ActionMenuItem) or COMPACT_ITEM_SIZE.
+//! The inline data of the level is allocated after it.
+static ActionMenuItem *level_append_item(ActionMenuLevel *level, const char *label, size_t size) {
   ActionMenuItem* item = NULL;
   if(level && level->num_items < level->max_items) {
-    item = malloc(sizeof(ActionMenuItem));
+    item = heap_malloc(size + level->inline_data_size);
     if(item) {
-      memset(item, 0, sizeof(ActionMenuItem));
+      memset(item, 0, size + level->inline_data_size);
       if(label){
-        item->label = malloc(strlen(label) + 1); 
+        item->label = label_store_create(label);
         if(item->label == NULL) {
-          free(item);
+          heap_free(item);
           item = NULL;
           return item;
         }
-        strcpy(item->label, label);
       }
-      item->cb = cb;
-      item->action_data = action_data;
+      if(size < sizeof(ActionMenuItem)) {
+        item->flags |= ITEM_FLAG_COMPACT;
+      }
+      if(level->inline_data_size) {
+        item->flags |= ITEM_FLAG_INLINE_DATA;
+      }
       level->items[level->num_items] = item;
       level->num_items = level->num_items+1;
     }
@@ -134,34 +616,175 @@ ActionMenuItem *action_menu_level_add_action(ActionMenuLevel *level,
   return item;
 }
 
+//! Add an action to an ActionLevel
+//! @param level the level to add the action to
+//! @param label the text to display for the action in the menu
+//! @param cb the callback that will be triggered when this action is actuated
+//! @param action_data data to pass to the callback for this action
+//! @return a reference to the new \ref ActionMenuItem on success, NULL if the level is full,
+//! out of memory or the label is invalid (see \ref action_menu_set_label_dictionary)
+ActionMenuItem *action_menu_level_add_action(ActionMenuLevel *level,
+                                             const char *label,
+                                             ActionMenuPerformActionCb cb,
+                                             void *action_data){
+  ActionMenuItem* item = level_append_item(level, label, sizeof(ActionMenuItem));
+  if(item) {
+    item->cb = cb;
+    if(item->flags & ITEM_FLAG_INLINE_DATA) {
+      if(action_data) {
+        memcpy(action_menu_item_get_action_data(item), action_data, level->inline_data_size);
+      }
+    }
+    else {
+      item->action_data = action_data;
+    }
+  }
+  return item;
+}
+
+//! Add an item without callback nor action data to an ActionLevel. The item
+//! only stores its label, which makes it about half the size of an action:
+//! actuating it calls the level default action with the index of the item.
+//! @param level the level to add the item to
+//! @param label the text to display for the item in the menu
+//! @return a reference to the new \ref ActionMenuItem on success, NULL if the level is full,
+//! out of memory or the label is invalid (see \ref action_menu_set_label_dictionary)
+//! @note such items can't have a secondary (long press) action
+//! @see action_menu_level_set_default_action
+ActionMenuItem *action_menu_level_add_item(ActionMenuLevel *level,
+                                           const char *label){
+  return level_append_item(level, label, COMPACT_ITEM_SIZE);
+}
+
+//! Reserve inline storage for the action data of the items added afterwards to a level.
+//! The storage is allocated together with each item and freed with it, so small
+//! payloads need neither a separate allocation nor cleanup in
+//! \ref action_menu_hierarchy_destroy.
+//! @param level the level
+//! @param size the number of bytes reserved per item, 0 to store action_data pointers again
+//! @note with inline storage, \ref action_menu_level_add_action copies size bytes from
+//! its action_data argument (if not NULL, zeroed otherwise) and
+//! \ref action_menu_item_get_action_data returns the inline copy
+void action_menu_level_set_inline_data_size(ActionMenuLevel *level, uint8_t size){
+  if(level) {
+    level->inline_data_size = size;
+  }
+}
+
+//! Set the default action of a level, performed for the items without their own callback
+//! @param level the level
+//! @param cb the callback triggered with the index of the actuated item, NULL to remove it
+void action_menu_level_set_default_action(ActionMenuLevel *level,
+                                          ActionMenuPerformIndexedActionCb cb){
+  if(level) {
+    level->default_cb = cb;
+  }
+}
+
+//! Set the secondary action of an item, performed when SELECT is long pressed
+//! @param item the item, typically returned by \ref action_menu_level_add_action
+//! @param cb the callback triggered on long press, NULL to remove it.
+//! It receives the item like its regular action does.
+//! @note long pressing an item without secondary action performs its regular action
+void action_menu_item_set_long_press_action(ActionMenuItem *item,
+                                            ActionMenuPerformActionCb cb){
+  if(item && !(item->flags & ITEM_FLAG_COMPACT)) {
+    item->long_press_cb = cb;
+  }
+}
+
+//! Add the confirm item of a multi-select level. Adding it switches the level
+//! to multi-select mode: SELECT on any other item without child toggles its
+//! selection, and SELECT on the confirm item performs a single action for all
+//! the selected items.
+//! @param level the level to add the confirm item to
+//! @param label the text to display for the confirm item
+//! @param cb the callback triggered with the selection when the confirm item is actuated
+//! @return a reference to the new \ref ActionMenuItem on success, NULL if the level is full,
+//! out of memory or the label is invalid (see \ref action_menu_set_label_dictionary)
+//! or already has a confirm item
+//! @note the selection is cleared once the callback returns
+ActionMenuItem *action_menu_level_add_confirm(ActionMenuLevel *level,
+                                              const char *label,
+                                              ActionMenuMultiSelectCb cb){
+  if(level == NULL || level->selection)
+    return NULL;
+
+  level->selection = heap_calloc((level->max_items + 7) / 8, 1);
+  if(level->selection == NULL)
+    return NULL;
+
+  ActionMenuItem *item = action_menu_level_add_action(level, label, NULL, NULL);
+  if(item == NULL) {
+    heap_free(level->selection);
+    level->selection = NULL;
+    return NULL;
+  }
+
+  level->confirm_item = item;
+  level->confirm_cb = cb;
+  return item;
+}
+
+//! Whether an item of a multi-select level is selected
+//! @param level the level
+//! @param index the index of the item in the level
+//! @return true if the item is selected, false otherwise or if the level isn't a multi-select one
+bool action_menu_level_is_item_selected(const ActionMenuLevel *level, uint16_t index){
+  if(level == NULL || level->selection == NULL || index >= level->num_items)
+    return false;
+
+  return level->selection[index / 8] & (1 << (index % 8));
+}
+
+//! Start a new section in an ActionMenuLevel. The items added afterwards are
+//! grouped under a header showing the given label, until the next section starts.
+//! Long pressing UP or DOWN jumps to the previous or next section. Menus whose
+//! hierarchy has no section don't subscribe to the long presses, so that
+//! UP and DOWN respond on press.
+//! @param level the level to add the section to
+//! @param label the text to display in the section header
+//! @return true on success, false if out of memory or the label is invalid
+//! (see \ref action_menu_set_label_dictionary)
+bool action_menu_level_add_section(ActionMenuLevel *level, const char *label){
+  if(level == NULL)
+    return false;
+
+  ActionMenuSection *sections = heap_realloc(level->sections, (level->num_sections + 1) * sizeof(ActionMenuSection));
+  if(sections == NULL)
+    return false;
+  level->sections = sections;
+
+  ActionMenuSection *section = &sections[level->num_sections];
+  section->first_item = level->num_items;
+  section->label = NULL;
+  if(label) {
+    section->label = label_store_create(label);
+    if(section->label == NULL)
+      return false;
+  }
+  level->num_sections++;
+  return true;
+}
+
 //! Add a child to this ActionMenuLevel
 //! @param level the parent level
 //! @param child the child level
 //! @param label the text to display in the action menu for this level
-//! @return a reference to the new \ref ActionMenuItem on success, NULL if the level is full
+//! @return a reference to the new \ref ActionMenuItem on success, NULL if the level is full,
+//! out of memory or the label is invalid (see \ref action_menu_set_label_dictionary)
 ActionMenuItem *action_menu_level_add_child(ActionMenuLevel *level,
                                             ActionMenuLevel *child,
                                             const char *label){
-  ActionMenuItem* item = NULL;
-  if(level && level->num_items < level->max_items) {
-    item = malloc(sizeof(ActionMenuItem));
-    if(item) {
-      memset(item, 0, sizeof(ActionMenuItem));
-      item->child = child;
-      child->parent = level;
-      if(label){
-        item->label = malloc(strlen(label) + 1); 
-        if(item->label == NULL) {
-          free(item);
-          item = NULL;
-          return item;
-        }
-        strcpy(item->label, label);
-      }
-      child->level = level->level + 1;
-      level->items[level->num_items] = item;
-      level->num_items = level->num_items+1;
-    }
+  if(child == NULL)
+    return NULL;
+
+  // The child is only linked once the item and its label are allocated
+  ActionMenuItem* item = level_append_item(level, label, sizeof(ActionMenuItem));
+  if(item) {
+    item->child = child;
+    child->parent = level;
+    child->level = level->level + 1;
   }
   return item;
 }
@@ -170,29 +793,38 @@ ActionMenuItem *action_menu_level_add_child(ActionMenuLevel *level,
 //! @param root the root level in the hierarchy
 //! @param each_cb a callback to call on every \ref ActionMenuItem in every level
 //! @param context a context pointer to pass to each_cb on invocation
-//! @note Typical implementations will cleanup memory allocated for the item label/data
-//!       associated with each item in the callback
+//! @note Typical implementations will cleanup memory allocated for the action data
+//!       associated with each item in the callback. Labels are owned and freed by the
+//!       library once the callback returns: the callback may read them but must not free them.
 //! @note Hierarchy is traversed in post-order.
 //!       In other words, all children items are freed before their parent is freed.
 void action_menu_hierarchy_destroy(const ActionMenuLevel *root,
                                    ActionMenuEachItemCb each_cb,
                                    void *context){
   if(root) {
-    for(uint16_t i=0; i<root->num_items; i++){
+    // Elements of strided levels belong to the app
+    for(uint16_t i=0; root->items && i<root->num_items; i++){
       ActionMenuItem* item = root->items[i];
-      if(item->label) {
-        free(item->label);
-      }
       if(item->child) {
         action_menu_hierarchy_destroy(item->child, each_cb, context);
       }
+      // The item is still complete, label included, when the callback sees it
       if(each_cb){
+        CALLBACK_START(start);
         each_cb(item, context);
+        CALLBACK_DONE(start, "each");
       }
-      free(item);
+      label_store_destroy(item->label);
+      heap_free(item);
+    }
+    for(uint16_t i=0; i<root->num_sections; i++){
+      label_store_destroy(root->sections[i].label);
     }
-    free(root->items);
-    free((ActionMenuLevel *)root);
+    heap_free(root->sections);
+    heap_free(root->selection);
+    heap_free(root->cache);
+    heap_free(root->items);
+    heap_free((ActionMenuLevel *)root);
   }
 }
 
@@ -211,71 +843,370 @@ ActionMenuLevel *action_menu_get_root_level(ActionMenu *action_menu){
   return action_menu ? (ActionMenuLevel *)action_menu->current_level : NULL;
 }
 
+static uint16_t level_num_menu_sections(const ActionMenuLevel *level);
+
+static LevelCache *level_cache_create(uint16_t num_cells, uint16_t num_headers) {
+  size_t size = sizeof(LevelCache) + (num_cells + num_headers) * sizeof(int16_t);
+  LevelCache *cache = heap_malloc(size);
+  if(cache) {
+    memset(cache, 0, size);
+    cache->num_cells = num_cells;
+    cache->num_headers = num_headers;
+    cache->cell_heights = (int16_t *)(cache + 1);
+    cache->header_heights = cache->cell_heights + num_cells;
+  }
+  return cache;
+}
+
+//! Forget the measurements of a level and of its descendants, e.g. after
+//! their labels changed. The caches are cleared when the levels are shown.
+static void hierarchy_invalidate_caches(const ActionMenuLevel *level) {
+  if(level->cache) {
+    level->cache->valid = false;
+  }
+  for(uint16_t i=0; level->items && i<level->num_items; i++) {
+    if(level->items[i]->child) {
+      hierarchy_invalidate_caches(level->items[i]->child);
+    }
+  }
+}
+
+//! Whether a level is shown by an open menu other than except, or is an
+//! ancestor of a shown level
+static bool level_on_open_path(const ActionMenuLevel *level, const ActionMenu *except) {
+  for(ActionMenu *menu = s_open_menus; menu; menu = menu->next_open) {
+    if(menu == except)
+      continue;
+    for(const ActionMenuLevel *it = menu->current_level; it; it = it->parent) {
+      if(it == level)
+        return true;
+    }
+  }
+  return false;
+}
+
+//! Free the caches of the levels of a hierarchy which aren't on the path of
+//! an open menu other than except: going back measures nothing, while a
+//! hierarchy holds a few caches instead of one per visited level
+static void hierarchy_trim_caches(const ActionMenuLevel *level, const ActionMenu *except) {
+  ActionMenuLevel *mutable_level = (ActionMenuLevel *)level;
+  if(level->cache && !level_on_open_path(level, except)) {
+    heap_free(level->cache);
+    mutable_level->cache = NULL;
+  }
+  for(uint16_t i=0; level->items && i<level->num_items; i++) {
+    if(level->items[i]->child) {
+      hierarchy_trim_caches(level->items[i]->child, except);
+    }
+  }
+}
+
+//! Whether a level cache holds measurements usable by a menu
+static bool level_cache_matches(const LevelCache *cache, const ActionMenu *menu) {
+  return cache->valid &&
+         cache->font == menu->font &&
+         cache->font_load == menu->font_load &&
+         cache->header_font == menu->header_font &&
+         cache->width == menu->layout.cell_width &&
+         cache->measure == menu->config->renderer.measure &&
+         cache->num_cells == menu->current_level->num_items &&
+         cache->num_headers == level_num_menu_sections(menu->current_level);
+}
+
+//! Get the cache of the current level ready for the font and geometry of a menu,
+//! keeping its measurements if they still apply. Without memory for the cache,
+//! cells are measured each time MenuLayer asks.
+static void level_cache_prepare(ActionMenu *menu) {
+  ActionMenuLevel *level = (ActionMenuLevel *)menu->current_level;
+  if(level == NULL || (level->cache && level_cache_matches(level->cache, menu)))
+    return;
+
+  uint16_t num_cells = level->num_items;
+  uint16_t num_headers = level_num_menu_sections(level);
+  if(level->cache && (level->cache->num_cells != num_cells || level->cache->num_headers != num_headers)) {
+    heap_free(level->cache);
+    level->cache = NULL;
+  }
+  if(level->cache == NULL) {
+    level->cache = level_cache_create(num_cells, num_headers);
+    if(level->cache == NULL)
+      return;
+  }
+
+  LevelCache *cache = level->cache;
+  memset(cache->cell_heights, 0, (num_cells + num_headers) * sizeof(int16_t));
+  cache->font = menu->font;
+  cache->font_load = menu->font_load;
+  cache->header_font = menu->header_font;
+  cache->width = menu->layout.cell_width;
+  cache->measure = menu->config->renderer.measure;
+  cache->valid = true;
+}
+
+//! Get the cache of the current level of a menu, NULL if it can't be used
+static LevelCache *menu_cache(ActionMenu *menu) {
+  LevelCache *cache = menu->current_level->cache;
+  return cache && level_cache_matches(cache, menu) ? cache : NULL;
+}
+
+//! Reload the MenuLayer and the crumbs column, or defer it until the
+//! menu is visible again. Repeated requests while hidden are coalesced.
+static void refresh_menu(ActionMenu *menu, bool reset_selection) {
+  if(reset_selection) {
+    menu->reset_selection_pending = true;
+  }
+
+  // Nothing is allocated nor cleared while hidden: until the cache is prepared
+  // on appear, MenuLayer queries for a new level or labels are measured uncached
+  if(!menu->visible) {
+    menu->refresh_pending = true;
+    return;
+  }
+
+  level_cache_prepare(menu);
+  menu_layer_reload_data(menu->menulayer);
+  if(menu->reset_selection_pending) {
+    menu_layer_set_selected_index(menu->menulayer, (MenuIndex){0,0}, MenuRowAlignTop, false);
+  }
+  layer_mark_dirty(menu->column_layer);
+
+  menu->refresh_pending = false;
+  menu->reset_selection_pending = false;
+}
+
 static void layer_update_proc(Layer *layer, GContext *ctx) {
   ActionMenu *menu = *((ActionMenu**)layer_get_data(layer));
   GRect bounds = layer_get_bounds(layer);
 
+#if ACTION_MENU_STATS
+  // The whole window is redrawn on each frame, including this column
+  SESSION_COUNT(menu, frames);
+  if(menu->prop_animation && animation_is_scheduled((Animation*) menu->prop_animation)) {
+    SESSION_COUNT(menu, animation_frames);
+  }
+
+  if(menu->redraw_pending) {
+    menu->redraw_pending = false;
+    LATENCY_RECORD(click_to_redraw, menu->press_time);
+  }
+#endif
+
   graphics_context_set_fill_color(ctx, menu->config->colors.background);
   graphics_fill_rect(ctx, bounds, 0, 0);
 
   graphics_context_set_fill_color(ctx, menu->config->colors.foreground);
+#ifdef PBL_ROUND
+  // The top of the column is hidden by the bezel: center the crumbs vertically
+  int16_t top = bounds.size.h/2 - (menu->current_level->level - 1) * 4;
+#else
+  int16_t top = 10;
+#endif
   for(uint8_t i=0; i<menu->current_level->level; i++){
-    graphics_fill_circle(ctx, (GPoint){bounds.size.w/2, 10 + i * 8}, 2);
+    graphics_fill_circle(ctx, (GPoint){bounds.size.w/2, top + i * 8}, 2);
+  }
+}
+
+// The MenuLayer sections of a level are its sections, preceded by a section
+// without header for the items added before the first section if any
+
+static bool level_has_leading_section(const ActionMenuLevel *level) {
+  return level->num_sections == 0 || level->sections[0].first_item > 0;
+}
+
+static uint16_t level_num_menu_sections(const ActionMenuLevel *level) {
+  return level->num_sections + (level_has_leading_section(level) ? 1 : 0);
+}
+
+static const ActionMenuSection *level_get_section(const ActionMenuLevel *level, uint16_t menu_section) {
+  if(level_has_leading_section(level)) {
+    return menu_section ? &level->sections[menu_section - 1] : NULL;
   }
+  return &level->sections[menu_section];
+}
+
+static uint16_t level_section_first_item(const ActionMenuLevel *level, uint16_t menu_section) {
+  const ActionMenuSection *section = level_get_section(level, menu_section);
+  return section ? section->first_item : 0;
+}
+
+static uint16_t level_section_num_items(const ActionMenuLevel *level, uint16_t menu_section) {
+  uint16_t end = menu_section + 1 < level_num_menu_sections(level)
+                 ? level_section_first_item(level, menu_section + 1)
+                 : level->num_items;
+  return end - level_section_first_item(level, menu_section);
+}
+
+static uint16_t cell_item_index(const ActionMenuLevel *level, const MenuIndex *index) {
+  return level_section_first_item(level, index->section) + index->row;
+}
+
+static uint16_t selected_item_index(ActionMenu *menu) {
+  MenuIndex index = menu_layer_get_selected_index(menu->menulayer);
+  return cell_item_index(menu->current_level, &index);
+}
+
+static uint16_t cb_get_num_sections(MenuLayer *ml, void *ctx) {
+  ActionMenu *menu = ctx;
+  return level_num_menu_sections(menu->current_level);
 }
 
 static uint16_t cb_get_num_rows(MenuLayer *ml, uint16_t i_section, void *ctx) {
   ActionMenu *menu = ctx;
-  return menu->current_level->num_items;
+  return level_section_num_items(menu->current_level, i_section);
 }
 
-static int16_t cb_get_cell_height(MenuLayer *ml, MenuIndex *i_cell, void *ctx) {
+static GRect header_text_bounds(ActionMenu *menu, GRect bounds) {
+  bounds.origin.x += CELL_MARGIN + CELL_PADDING + menu->layout.cell_inset;
+  bounds.size.w -= 2*(CELL_MARGIN + CELL_PADDING + menu->layout.cell_inset);
+  return bounds;
+}
+
+static int16_t cb_get_header_height(MenuLayer *ml, uint16_t i_section, void *ctx) {
+  ActionMenu *menu = ctx;
+
+  const ActionMenuSection *section = level_get_section(menu->current_level, i_section);
+  if(section == NULL || section->label == NULL) {
+    return 0;
+  }
+
+  LevelCache *cache = menu_cache(menu);
+  if(cache && i_section < cache->num_headers && cache->header_heights[i_section]) {
+    return cache->header_heights[i_section];
+  }
+
+  SESSION_COUNT(menu, text_measurements);
+
+  GSize size =
+    graphics_text_layout_get_content_size(
+      label_decode(section->label),
+      menu->header_font,
+      header_text_bounds(menu, GRect(0,0,menu->layout.cell_width,menu->layout.text_max_height)),
+      GTextOverflowModeWordWrap, menu->layout.text_alignment);
+
+  int16_t height = size.h + 4;
+  if(cache && i_section < cache->num_headers) {
+    cache->header_heights[i_section] = height;
+  }
+  return height;
+}
+
+static void cb_draw_header(GContext *g_ctx, const Layer *l_cell, uint16_t i_section, void *ctx) {
   ActionMenu *menu = ctx;
 
-  GSize size = 
-    graphics_text_layout_get_content_size( 
-      menu->current_level->items[i_cell->row]->label, 
-      fonts_get_system_font(ACTION_MENU_FONT), 
-      GRect(0,0,144 - MENU_LAYER_OFFSET - 16,168), 
-      GTextOverflowModeWordWrap, GTextAlignmentLeft);
+  const ActionMenuSection *section = level_get_section(menu->current_level, i_section);
+  if(section == NULL || section->label == NULL) {
+    return;
+  }
+
+  GRect bounds = layer_get_bounds(l_cell);
+  graphics_context_set_fill_color(g_ctx, GColorBlack);
+  graphics_fill_rect(g_ctx, bounds, 0, GCornerNone);
+
+  graphics_context_set_text_color(g_ctx, GColorWhite);
+  SESSION_COUNT(menu, text_draws);
+  graphics_draw_text(g_ctx,
+    label_decode(section->label),
+    menu->header_font,
+    header_text_bounds(menu, bounds),
+    GTextOverflowModeWordWrap,
+    menu->layout.text_alignment,
+    0);
+}
+
+static int16_t measure_cell(ActionMenu *menu, const ActionMenuItem *item) {
+  if(menu->config->renderer.measure) {
+    CALLBACK_START(start);
+    int16_t height = menu->config->renderer.measure(item, menu->layout.cell_width, menu->font, menu->config->context);
+    CALLBACK_DONE(start, "measure");
+    return height;
+  }
+
+  SESSION_COUNT(menu, text_measurements);
+
+  GSize size =
+    graphics_text_layout_get_content_size(
+      item_label(item),
+      menu->font,
+      GRect(0,0,menu->layout.text_width,menu->layout.text_max_height),
+      GTextOverflowModeWordWrap, menu->layout.text_alignment);
 
   return size.h + 8 + 8;
 }
 
+static int16_t cb_get_cell_height(MenuLayer *ml, MenuIndex *i_cell, void *ctx) {
+  ActionMenu *menu = ctx;
+  uint16_t row = cell_item_index(menu->current_level, i_cell);
+
+  LevelCache *cache = menu_cache(menu);
+  if(cache && row < cache->num_cells && cache->cell_heights[row]) {
+    return cache->cell_heights[row];
+  }
+
+  int16_t height = measure_cell(menu, level_get_item(menu->current_level, row, &menu->cell_item));
+  if(cache && row < cache->num_cells) {
+    cache->cell_heights[row] = height;
+  }
+  return height;
+}
+
 static void cb_draw_row(GContext *g_ctx, const Layer *l_cell, MenuIndex *i_cell, void *ctx) {
   ActionMenu *menu = ctx;
   GRect bounds = layer_get_bounds(l_cell);
+  uint16_t index = cell_item_index(menu->current_level, i_cell);
+  const ActionMenuItem *item = level_get_item(menu->current_level, index, &menu->cell_item);
+  bool selected = index == selected_item_index(menu);
+
+  if(menu->config->renderer.draw) {
+    CALLBACK_START(start);
+    menu->config->renderer.draw(g_ctx, l_cell, item, menu->current_level, index, selected, menu->font,
+                                menu->config->context);
+    CALLBACK_DONE(start, "draw");
+    return;
+  }
 
-  if(menu_layer_get_selected_index(menu->menulayer).row == i_cell->row) {
+  if(selected) {
     graphics_context_set_fill_color(g_ctx, GColorWhite);
     graphics_fill_rect(g_ctx, bounds, 0, GCornerNone);
   }
 
-  bounds.origin.x += 4;
-  bounds.size.w -= 2*4;
+  bounds.origin.x += CELL_MARGIN + menu->layout.cell_inset;
+  bounds.size.w -= 2*(CELL_MARGIN + menu->layout.cell_inset);
 
   graphics_context_set_fill_color(g_ctx, GColorBlack);
   graphics_fill_rect(g_ctx, bounds, 4, GCornersAll);
 
-  bounds.size.w -= 2*4;
-  bounds.origin.x += 4;
+  bounds.size.w -= 2*CELL_PADDING;
+  bounds.origin.x += CELL_PADDING;
 
   bounds.origin.y += 4;
   bounds.size.h -= 2*4;
 
+  SESSION_COUNT(menu, text_draws);
   graphics_draw_text(g_ctx,
-    menu->current_level->items[i_cell->row]->label,
-    fonts_get_system_font(ACTION_MENU_FONT),
+    item_label(item),
+    menu->font,
     bounds,
     GTextOverflowModeWordWrap,
-    GTextAlignmentLeft,
+    menu->layout.text_alignment,
     0);
 
-  if(menu->current_level->items[i_cell->row]->child && menu_layer_get_selected_index(menu->menulayer).row == i_cell->row) {
+  if(menu->current_level->selection && item != menu->current_level->confirm_item && !item->child) {
+    GRect box = (GRect){.origin={menu->layout.arrow_x, bounds.origin.y + (bounds.size.h - 7) / 2},.size={7,7}};
+    graphics_context_set_stroke_color(g_ctx, GColorWhite);
+    graphics_draw_rect(g_ctx, box);
+    if(action_menu_level_is_item_selected(menu->current_level, index)) {
+      graphics_context_set_fill_color(g_ctx, GColorWhite);
+      graphics_fill_rect(g_ctx, (GRect){.origin={box.origin.x + 2, box.origin.y + 2},.size={3,3}}, 0, GCornerNone);
+    }
+  }
+
+  if(item->child && selected) {
     if(menu->arrow_image == NULL){
       menu->arrow_image = gbitmap_create_with_data(ARROW_IMAGE_DATA);
+      COUNT_HEAP_OPERATIONS(1);
     }
-    graphics_draw_bitmap_in_rect(g_ctx, menu->arrow_image, (GRect){.origin={116, bounds.origin.y + (bounds.size.h - 4) / 2},.size={7,5}});
+    if(menu->arrow_image)
+      graphics_draw_bitmap_in_rect(g_ctx, menu->arrow_image, (GRect){.origin={menu->layout.arrow_x, bounds.origin.y + (bounds.size.h - 4) / 2},.size={7,5}});
   }
 }
 
@@ -285,73 +1216,239 @@ static void load_cb(Window *window) {
   Layer *window_layer = window_get_root_layer(window);
   GRect bounds = layer_get_bounds(window_layer);
 
+  if(menu->config->font.resource_id) {
+    menu->font = font_cache_acquire(menu->config->font.resource_id, &menu->font_load);
+  }
+  if(menu->font == NULL) {
+    menu->font_load = 0;
+    menu->font = fonts_get_system_font(menu->config->font.system_key ? menu->config->font.system_key : ACTION_MENU_FONT);
+  }
+  // Headers use the font selected by the config, a smaller one by default
+  menu->header_font = menu->config->font.system_key || menu->font_load ? menu->font : fonts_get_system_font(ACTION_MENU_FONT_SMALL);
+
+  int16_t cell_width = bounds.size.w - MENU_LAYER_OFFSET;
+  menu->layout.cell_width = cell_width;
+  menu->layout.cell_inset = ROUND_CELL_INSET;
+  menu->layout.text_width = cell_width - 2*(CELL_MARGIN + CELL_PADDING + ROUND_CELL_INSET);
+  menu->layout.text_max_height = bounds.size.h;
+  menu->layout.arrow_x = cell_width - ROUND_CELL_INSET - 14;
+#ifdef PBL_ROUND
+  menu->layout.text_alignment = GTextAlignmentCenter;
+#else
+  menu->layout.text_alignment = GTextAlignmentLeft;
+#endif
+
   menu->bg_layer = layer_create(bounds);
+  menu->column_layer = layer_create_with_data((GRect){.origin={0, 0}, .size={MENU_LAYER_OFFSET, bounds.size.h}}, sizeof(ActionMenu **));
+  menu->menulayer = menu_layer_create((GRect){.origin={MENU_LAYER_OFFSET, 0}, .size={bounds.size.w - MENU_LAYER_OFFSET, bounds.size.h}});
+  COUNT_HEAP_OPERATIONS(3);
+  if(menu->bg_layer == NULL || menu->column_layer == NULL || menu->menulayer == NULL) {
+    // action_menu_open removes the window, which has nothing to show
+    if(menu->bg_layer)
+      layer_destroy(menu->bg_layer);
+    if(menu->column_layer)
+      layer_destroy(menu->column_layer);
+    if(menu->menulayer)
+      menu_layer_destroy(menu->menulayer);
+    COUNT_HEAP_OPERATIONS((menu->bg_layer != NULL) + (menu->column_layer != NULL) + (menu->menulayer != NULL));
+    menu->bg_layer = NULL;
+    menu->column_layer = NULL;
+    menu->menulayer = NULL;
+    return;
+  }
+
+  level_cache_prepare(menu);
+
   layer_add_child(window_layer, menu->bg_layer);
 
-  menu->column_layer = layer_create_with_data((GRect){.origin={0, 0}, .size={MENU_LAYER_OFFSET, bounds.size.h}}, sizeof(ActionMenu **));
   *((ActionMenu **)layer_get_data(menu->column_layer)) = menu;
   layer_set_update_proc(menu->column_layer, layer_update_proc);
   layer_add_child(menu->bg_layer, menu->column_layer);
 
-  menu->menulayer = menu_layer_create((GRect){.origin={MENU_LAYER_OFFSET, 0}, .size={bounds.size.w - MENU_LAYER_OFFSET, bounds.size.h}});
   menu_layer_set_callbacks(menu->menulayer, menu, (MenuLayerCallbacks) {
+    .get_num_sections   = cb_get_num_sections,
     .get_num_rows       = cb_get_num_rows,
+    .get_header_height  = cb_get_header_height,
+    .draw_header        = cb_draw_header,
     .draw_row           = cb_draw_row,
     .get_cell_height    = cb_get_cell_height,
   });
   layer_add_child(menu->bg_layer, menu_layer_get_layer(menu->menulayer));
 }
 
-static void destroy_property_animation(PropertyAnimation **prop_animation) {
-  if (*prop_animation == NULL) {
+//! Forget the level transition animation once it stopped. SDK3 destroys
+//! stopped animations itself, SDK2 leaves it to the app.
+static void release_menu_animation(ActionMenu *menu, Animation *animation) {
+  if(animation == NULL || menu->prop_animation != (PropertyAnimation*) animation)
+    return;
+
+#ifdef PBL_SDK_2
+  property_animation_destroy(menu->prop_animation);
+#endif
+  COUNT_HEAP_OPERATIONS(1);
+  menu->prop_animation = NULL;
+}
+
+//! Stop the level transition animation, if any. Its stopped handler runs and
+//! releases it, and may start the next transition.
+static void stop_menu_animation(ActionMenu *menu) {
+  Animation *animation = (Animation*) menu->prop_animation;
+  if(animation == NULL)
     return;
+
+  if(animation_is_scheduled(animation)) {
+    animation_unschedule(animation);
   }
+  release_menu_animation(menu, animation);
+}
+
+static void notify_will_close(ActionMenu *menu) {
+  if(menu->will_close_sent)
+    return;
 
-  if (animation_is_scheduled((Animation*) *prop_animation)) {
-    animation_unschedule((Animation*) *prop_animation);
+  menu->will_close_sent = true;
+  if(menu->config->will_close) {
+    CALLBACK_START(start);
+    menu->config->will_close(menu, menu->performed_action, menu->config->context);
+    CALLBACK_DONE(start, "will_close");
   }
+}
+
+static void settle_level_transition(ActionMenu *menu);
+
+static void appear_cb(Window *window) {
+  ActionMenu *menu = window_get_user_data(window);
 
-  property_animation_destroy(*prop_animation);
-  *prop_animation = NULL;
+  menu->visible = true;
+#if ACTION_MENU_STATS
+  menu->visible_since = now_ms();
+#endif
+  if(menu->refresh_pending) {
+    refresh_menu(menu, false);
+  }
+  else if(menu->menulayer) {
+    // Another menu may have measured the level for its own fonts meanwhile
+    level_cache_prepare(menu);
+  }
 }
 
 static void disappear_cb(Window *window) {
   ActionMenu *menu = window_get_user_data(window);
 
-  if(menu->config->will_close)
-    menu->config->will_close(menu, menu->performed_action, menu->config->context);
+  menu->visible = false;
+#if ACTION_MENU_STATS
+  menu->session.on_screen_ms += now_ms() - menu->visible_since;
+#endif
+  if(menu->menulayer == NULL)
+    return;
+
+  settle_level_transition(menu);
+
+  // The menu may only be covered by another window (e.g. a notification)
+  if(menu->closing)
+    notify_will_close(menu);
+}
+
+//! Free an ActionMenu and the memory it owns, besides its window and layers
+static void menu_destroy(ActionMenu *menu) {
+  for(ActionMenu **it = &s_open_menus; *it; it = &(*it)->next_open) {
+    if(*it == menu) {
+      *it = menu->next_open;
+      break;
+    }
+  }
+
+  heap_free(menu->config);
+  heap_free(menu);
 }
 
 static void unload_cb(Window *window) {
   ActionMenu *menu = window_get_user_data(window);
+  // A menu which couldn't create its layers was never returned to the app
+  bool loaded = menu->menulayer != NULL;
 
-  if(menu->arrow_image)
+  if(menu->arrow_image) {
     gbitmap_destroy(menu->arrow_image);
+    COUNT_HEAP_OPERATIONS(1);
+  }
 
-  destroy_property_animation(&menu->prop_animation);
-  layer_destroy(menu->column_layer);
-  layer_destroy(menu->bg_layer);
-  menu_layer_destroy(menu->menulayer);
-  window_destroy(window);
+  font_cache_release(menu->font);
 
-  if(menu->config->did_close)
-    menu->config->did_close(menu, menu->performed_action, menu->config->context);
+  stop_menu_animation(menu);
+  if(loaded) {
+    layer_destroy(menu->column_layer);
+    layer_destroy(menu->bg_layer);
+    menu_layer_destroy(menu->menulayer);
+    COUNT_HEAP_OPERATIONS(3);
+  }
+  window_destroy(window);
+  COUNT_HEAP_OPERATIONS(1);
+  hierarchy_trim_caches(menu->config->root_level, menu);
+
+  if(loaded) {
+    notify_will_close(menu);
+#if ACTION_MENU_STATS
+    menu->session.heap_operations = s_heap_operations - menu->heap_operations_at_open;
+#endif
+    if(menu->config->did_close) {
+      CALLBACK_START(start);
+      menu->config->did_close(menu, menu->performed_action, menu->config->context);
+      CALLBACK_DONE(start, "did_close");
+    }
+  }
 
-  free(menu->config);
-  free(menu);
+  menu_destroy(menu);
 }
 
 static void animate_menu(ActionMenu *menu);
 
+//! Show the level a menu is transitioning to
+static void enter_pending_level(ActionMenu *menu) {
+  menu->current_level = menu->tmp_level;
+  menu->tmp_level = NULL;
+  hierarchy_trim_caches(menu->config->root_level, NULL);
+  refresh_menu(menu, true);
+}
+
+static void animation_in_stopped(Animation *animation, bool finished, void *data) {
+  ActionMenu *menu = data;
+  release_menu_animation(menu, animation);
+
+#if ACTION_MENU_STATS
+  if(menu->back_pending && finished) {
+    LATENCY_RECORD(back_to_level_shown, menu->back_time);
+  }
+  menu->back_pending = false;
+#endif
+}
+
 static void animation_out_stopped(Animation *animation, bool finished, void *data) {
   ActionMenu *menu = data;
+  release_menu_animation(menu, animation);
 
-  menu->current_level = menu->tmp_level;
-  menu->tmp_level = NULL;
-  menu_layer_reload_data(menu->menulayer);
-  menu_layer_set_selected_index(menu->menulayer, (MenuIndex){0,0}, MenuRowAlignTop, false);
-  
-  animate_menu(menu);
+  enter_pending_level(menu);
+
+  if(menu->visible) {
+    animate_menu(menu);
+  }
+}
+
+//! Jump to the end of any running level transition without animating,
+//! used when the menu gets hidden in the middle of it
+static void settle_level_transition(ActionMenu *menu) {
+  // Unscheduling the out animation runs animation_out_stopped, which doesn't
+  // start the in animation while hidden
+  stop_menu_animation(menu);
+
+  if(menu->tmp_level) {
+    enter_pending_level(menu);
+  }
+
+  GRect frame = layer_get_frame(menu->bg_layer);
+  if(frame.origin.x != 0) {
+    frame.origin.x = 0;
+    layer_set_frame(menu->bg_layer, frame);
+  }
 }
 
 static void animate_menu(ActionMenu *menu) {
@@ -365,42 +1462,136 @@ static void animate_menu(ActionMenu *menu) {
     to_rect.origin.x = 0;
   }
 
-  destroy_property_animation(&menu->prop_animation);
+  // Stopping a running out animation may start the in one from its handler
+  while(menu->prop_animation) {
+    stop_menu_animation(menu);
+  }
 
+  AnimationStoppedHandler stopped = to_rect.origin.x ? animation_out_stopped : animation_in_stopped;
   menu->prop_animation = property_animation_create_layer_frame(layer, NULL, &to_rect);
+  COUNT_HEAP_OPERATIONS(1);
+  if(menu->prop_animation == NULL) {
+    // Without memory for the animation, jump to its end
+    layer_set_frame(layer, to_rect);
+    stopped(NULL, true, menu);
+    return;
+  }
   animation_set_duration((Animation*) menu->prop_animation, 150);
   animation_set_curve((Animation*) menu->prop_animation, AnimationCurveEaseInOut);
-  animation_set_handlers((Animation*) menu->prop_animation, (AnimationHandlers) {.stopped = to_rect.origin.x ? animation_out_stopped : NULL}, menu);
+  animation_set_handlers((Animation*) menu->prop_animation, (AnimationHandlers) {.stopped = stopped}, menu);
 
   animation_schedule((Animation*) menu->prop_animation);
 }
 
+static void record_press(ActionMenu *menu) {
+#if ACTION_MENU_STATS
+  menu->press_time = now_ms();
+  menu->redraw_pending = true;
+#endif
+}
+
+static void close_menu(ActionMenu *menu, bool animated) {
+  menu->closing = true;
+  window_stack_remove(menu->window, animated);
+  if(menu->result_window) {
+    window_stack_push(menu->result_window, animated);
+  }
+}
+
+static void perform_action(ActionMenu *menu, const ActionMenuItem *item, ActionMenuPerformActionCb cb) {
+  menu->performed_action = item;
+  CALLBACK_START(start);
+  cb(menu, item, menu->config->context);
+  CALLBACK_DONE(start, "action");
+  LATENCY_RECORD(select_to_action_done, menu->press_time);
+
+  if(menu->frozen)
+    return;
+
+  close_menu(menu, true);
+}
+
+static void perform_indexed_action(ActionMenu *menu, const ActionMenuItem *item, uint16_t index,
+                                   ActionMenuPerformIndexedActionCb cb) {
+  menu->performed_action = item;
+  CALLBACK_START(start);
+  cb(menu, item, index, menu->config->context);
+  CALLBACK_DONE(start, "action");
+  LATENCY_RECORD(select_to_action_done, menu->press_time);
+
+  if(menu->frozen)
+    return;
+
+  close_menu(menu, true);
+}
+
+static void confirm_selection(ActionMenu *menu, ActionMenuLevel *level) {
+  uint16_t num_selected = 0;
+  for(uint16_t i=0; i<level->num_items; i++) {
+    num_selected += action_menu_level_is_item_selected(level, i);
+  }
+
+  menu->performed_action = level->confirm_item;
+  if(level->confirm_cb) {
+    CALLBACK_START(start);
+    level->confirm_cb(menu, level, level->selection, num_selected, menu->config->context);
+    CALLBACK_DONE(start, "confirm");
+    LATENCY_RECORD(select_to_action_done, menu->press_time);
+  }
+  memset(level->selection, 0, (level->max_items + 7) / 8);
+
+  if(menu->frozen)
+    return;
+
+  close_menu(menu, true);
+}
+
 static void select_click_handler(ClickRecognizerRef recognizer, void *context) {
   ActionMenu *menu = context;
 
   if(menu->frozen)
     return;
 
-  MenuLayer *ml = menu->menulayer;
-  uint16_t row = menu_layer_get_selected_index(ml).row;
-  if(menu->current_level->items[row]->child){
-    menu->tmp_level = menu->current_level->items[row]->child;
+  record_press(menu);
+
+  uint16_t row = selected_item_index(menu);
+  ActionMenuLevel *level = (ActionMenuLevel *)menu->current_level;
+  const ActionMenuItem *item = level_get_item(level, row, &menu->action_item);
+  if(item->child){
+    menu->tmp_level = item->child;
     animate_menu(menu);
   }
-  else if(menu->current_level->items[row]->cb) {
-    menu->performed_action = menu->current_level->items[row];
-    menu->performed_action->cb(
-      menu,
-      menu->performed_action,
-      menu->config->context);
+  else if(level->selection && item == level->confirm_item) {
+    confirm_selection(menu, level);
+  }
+  else if(level->selection) {
+    // Only the toggled cell changes: redraw without reloading the MenuLayer
+    level->selection[row / 8] ^= 1 << (row % 8);
+    layer_mark_dirty(menu_layer_get_layer(menu->menulayer));
+  }
+  else if(item_get_cb(item)) {
+    perform_action(menu, item, item_get_cb(item));
+  }
+  else if(level->default_cb) {
+    perform_indexed_action(menu, item, row, level->default_cb);
+  }
+}
 
-    if(menu->frozen)
-      return;
+static void select_long_click_handler(ClickRecognizerRef recognizer, void *context) {
+  ActionMenu *menu = context;
 
-    window_stack_remove(menu->window, true);
-    if(menu->result_window) {
-      window_stack_push(menu->result_window, true);
-    }
+  if(menu->frozen)
+    return;
+
+  record_press(menu);
+
+  const ActionMenuItem *item = level_get_item(menu->current_level, selected_item_index(menu), &menu->action_item);
+  if(item_get_long_press_cb(item)) {
+    perform_action(menu, item, item_get_long_press_cb(item));
+  }
+  else {
+    // Items without a secondary action behave as on a short press
+    select_click_handler(recognizer, context);
   }
 }
 
@@ -410,6 +1601,8 @@ static void up_click_handler(ClickRecognizerRef recognizer, void *context)   {
   if(menu->frozen)
     return;
 
+  record_press(menu);
+
   menu_layer_set_selected_next(menu->menulayer, true, MenuRowAlignCenter, true);
 }
 
@@ -419,57 +1612,157 @@ static void down_click_handler(ClickRecognizerRef recognizer, void *context) {
   if(menu->frozen)
     return;
 
+  record_press(menu);
+
   menu_layer_set_selected_next(menu->menulayer, false, MenuRowAlignCenter, true);
 }
 
+//! Select the first item of the previous or next section, or of the current
+//! section when going up from one of its other items
+static void select_section(ActionMenu *menu, bool up) {
+  MenuIndex index = menu_layer_get_selected_index(menu->menulayer);
+  uint16_t num_sections = level_num_menu_sections(menu->current_level);
+
+  if(up && index.row > 0) {
+    index.row = 0;
+    menu_layer_set_selected_index(menu->menulayer, index, MenuRowAlignTop, true);
+    return;
+  }
+
+  int32_t section = index.section;
+  do {
+    section += up ? -1 : 1;
+  } while(section >= 0 && section < num_sections && level_section_num_items(menu->current_level, section) == 0);
+
+  if(section >= 0 && section < num_sections) {
+    menu_layer_set_selected_index(menu->menulayer, (MenuIndex){section, 0}, MenuRowAlignTop, true);
+  }
+}
+
+static void up_long_click_handler(ClickRecognizerRef recognizer, void *context) {
+  ActionMenu *menu = context;
+
+  if(menu->frozen)
+    return;
+
+  record_press(menu);
+
+  if(menu->current_level->num_sections == 0) {
+    up_click_handler(recognizer, context);
+    return;
+  }
+  select_section(menu, true);
+}
+
+static void down_long_click_handler(ClickRecognizerRef recognizer, void *context) {
+  ActionMenu *menu = context;
+
+  if(menu->frozen)
+    return;
+
+  record_press(menu);
+
+  if(menu->current_level->num_sections == 0) {
+    down_click_handler(recognizer, context);
+    return;
+  }
+  select_section(menu, false);
+}
+
 static void back_click_handler(ClickRecognizerRef recognizer, void *context) {
   ActionMenu *menu = context;
 
   if(menu->frozen)
     return;
 
+  record_press(menu);
+
   if(menu->current_level->parent) {
+#if ACTION_MENU_STATS
+    menu->back_time = menu->press_time;
+    menu->back_pending = true;
+#endif
     menu->tmp_level = menu->current_level->parent;
     animate_menu(menu);
   }
   else {
+    menu->closing = true;
     window_stack_remove(menu->window, true);
   }
 }
 
+//! Whether a level or one of its descendants has sections
+static bool hierarchy_has_sections(const ActionMenuLevel *level) {
+  if(level->num_sections)
+    return true;
+
+  for(uint16_t i=0; level->items && i<level->num_items; i++) {
+    if(level->items[i]->child && hierarchy_has_sections(level->items[i]->child))
+      return true;
+  }
+  return false;
+}
+
 static void click_config_provider(void *context) {
+  ActionMenu *menu = context;
+
   window_single_click_subscribe(BUTTON_ID_SELECT, select_click_handler);
+  window_long_click_subscribe(BUTTON_ID_SELECT, 0, select_long_click_handler, NULL);
   window_single_click_subscribe(BUTTON_ID_UP, up_click_handler);
   window_single_click_subscribe(BUTTON_ID_DOWN, down_click_handler);
+  // A long click delays the click until the button is released: only
+  // menus with sections to jump to pay for it
+  if(hierarchy_has_sections(menu->config->root_level)) {
+    window_long_click_subscribe(BUTTON_ID_UP, 0, up_long_click_handler, NULL);
+    window_long_click_subscribe(BUTTON_ID_DOWN, 0, down_long_click_handler, NULL);
+  }
   window_single_click_subscribe(BUTTON_ID_BACK, back_click_handler);
 }
 
 //! Open a new ActionMenu.
 //! The ActionMenu acts much like a window. It fills the whole screen and handles clicks.
 //! @param config the configuration info for this new ActionMenu
-//! @return the new ActionMenu
+//! @return the new ActionMenu, NULL if out of memory; its callbacks are then never called
 ActionMenu *action_menu_open(ActionMenuConfig *config){
   ActionMenu *menu = NULL;
   if(config) {
-    menu = malloc(sizeof(ActionMenu));
+    menu = heap_malloc(sizeof(ActionMenu));
     if(menu) {
       memset(menu, 0, sizeof(ActionMenu));
-      menu->config = malloc(sizeof(ActionMenuConfig));
+#if ACTION_MENU_STATS
+      menu->heap_operations_at_open = s_heap_operations - 1;
+#endif
+      menu->config = heap_malloc(sizeof(ActionMenuConfig));
+      menu->window = menu->config ? window_create() : NULL;
+      COUNT_HEAP_OPERATIONS(menu->config != NULL);
+      if(menu->window == NULL) {
+        menu_destroy(menu);
+        return NULL;
+      }
       memcpy(menu->config, config, sizeof(ActionMenuConfig));
 
       menu->current_level = config->root_level;
+      menu->next_open = s_open_menus;
+      s_open_menus = menu;
 
-      menu->window = window_create();
       window_set_user_data(menu->window, menu);
       window_set_window_handlers(menu->window, (WindowHandlers) {
         .load = load_cb,
+        .appear = appear_cb,
         .disappear = disappear_cb,
         .unload = unload_cb,
       });
       window_set_click_config_provider_with_context(menu->window, click_config_provider, menu);
       window_set_background_color(menu->window, GColorBlack);
+#ifdef PBL_SDK_2
       window_set_fullscreen(menu->window, true);
+#endif
       window_stack_push(menu->window, true);
+      if(menu->menulayer == NULL) {
+        // Its window is unloaded later on, which frees the menu
+        window_stack_remove(menu->window, false);
+        return NULL;
+      }
     }
   }
   return menu;
@@ -508,10 +1801,268 @@ void action_menu_set_result_window(ActionMenu *action_menu, Window *result_windo
 //! @param action_menu the ActionMenu to close
 //! @param animated whether or not show a close animation
 void action_menu_close(ActionMenu *action_menu, bool animated){
-  window_stack_remove(action_menu->window, true);
-  if(action_menu->result_window) {
-    window_stack_push(action_menu->result_window, true);
+  if(action_menu) {
+    close_menu(action_menu, animated);
+  }
+}
+
+//! Reload the ActionMenu after labels or items of the displayed hierarchy changed.
+//! @note while the ActionMenu is hidden (e.g. covered by a result window or a
+//! notification) the reload is deferred and coalesced into a single refresh
+//! applied when the ActionMenu appears again
+//! @param action_menu the ActionMenu to reload
+void action_menu_reload(ActionMenu *action_menu){
+  if(action_menu) {
+    hierarchy_invalidate_caches(action_menu->config->root_level);
+    refresh_menu(action_menu, false);
+  }
+}
+
+static char fold_char(char c) {
+  return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+// Reads a stored label one character at a time, expanding the dictionary
+// codes on the fly instead of decoding the whole label into a buffer
+typedef struct {
+  const char *stored;
+  const char *word; // rest of the dictionary word being read, NULL if none
+} LabelCursor;
+
+static char label_cursor_next(LabelCursor *cursor) {
+  while(true) {
+    if(cursor->word && *cursor->word) {
+      return *cursor->word++;
+    }
+    if(cursor->stored == NULL || *cursor->stored == 0) {
+      return 0;
+    }
+    char c = *cursor->stored++;
+    if(!label_is_code(c)) {
+      return c;
+    }
+    cursor->word = s_label_dict[(uint8_t)c - LABEL_CODE_FIRST];
+  }
+}
+
+//! Case-insensitive key made of the first 8 characters of a label, so that
+//! most comparisons don't need to read both labels
+static uint64_t label_sort_key(const char *stored) {
+  LabelCursor cursor = {stored, NULL};
+  uint64_t key = 0;
+  char c = label_cursor_next(&cursor);
+  for(uint8_t i=0; i<8; i++) {
+    key <<= 8;
+    if(c) {
+      key |= (uint8_t)fold_char(c);
+      c = label_cursor_next(&cursor);
+    }
+  }
+  return key;
+}
+
+static int label_compare_folded(const ActionMenuItem *a, const ActionMenuItem *b) {
+  LabelCursor first = {a->label, NULL};
+  LabelCursor second = {b->label, NULL};
+  while(true) {
+    char ca = fold_char(label_cursor_next(&first));
+    char cb = fold_char(label_cursor_next(&second));
+    if(ca != cb || ca == 0) {
+      return (uint8_t)ca - (uint8_t)cb;
+    }
+  }
+}
+
+static int sort_entry_compare(const SortEntry *a, const SortEntry *b, bool by_label) {
+  if(a->key != b->key) {
+    return a->key < b->key ? -1 : 1;
+  }
+  return by_label ? label_compare_folded(a->item, b->item) : 0;
+}
+
+//! Stable binary insertion sort of entries [first, end): O(n log n) comparisons,
+//! the moves being cheap memmoves of the entries
+static void sort_entries(SortEntry *entries, uint16_t first, uint16_t end, bool by_label) {
+  for(uint16_t i=first + 1; i<end; i++) {
+    SortEntry entry = entries[i];
+
+    // Insert after the entries equal to this one to keep the sort stable
+    uint16_t low = first;
+    uint16_t high = i;
+    while(low < high) {
+      uint16_t middle = low + (high - low) / 2;
+      if(sort_entry_compare(&entries[middle], &entry, by_label) > 0)
+        high = middle;
+      else
+        low = middle + 1;
+    }
+
+    memmove(&entries[low + 1], &entries[low], (i - low) * sizeof(SortEntry));
+    entries[low] = entry;
+  }
+}
+
+//! Whether some items of a level are told apart by their index only, i.e.
+//! actuating them calls the level default action
+static bool level_has_indexed_items(const ActionMenuLevel *level) {
+  for(uint16_t i=0; level->default_cb && i<level->num_items; i++) {
+    const ActionMenuItem *item = level->items[i];
+    if(!item_get_cb(item) && !item->child && item != level->confirm_item) {
+      return true;
+    }
   }
+  return false;
 }
 
-#endif
\ No newline at end of file
+//! Sort the items of each section of a level
+static bool level_sort(ActionMenuLevel *level, ActionMenuSortKeyCb key_cb, void *context) {
+  if(level == NULL || level->items == NULL || level_has_indexed_items(level))
+    return false;
+
+  SortEntry *entries = heap_malloc(level->num_items * sizeof(SortEntry));
+  if(entries == NULL && level->num_items)
+    return false;
+
+  for(uint16_t i=0; i<level->num_items; i++) {
+    entries[i].item = level->items[i];
+    entries[i].index = i;
+    entries[i].selected = action_menu_level_is_item_selected(level, i);
+    // Flipping the sign bit of caller keys orders them as unsigned ones
+    if(key_cb) {
+      CALLBACK_START(start);
+      entries[i].key = (uint32_t)key_cb(level->items[i], context) ^ 0x80000000;
+      CALLBACK_DONE(start, "sort key");
+    }
+    else {
+      entries[i].key = label_sort_key(level->items[i]->label);
+    }
+  }
+
+  for(uint16_t s=0; s<level_num_menu_sections(level); s++) {
+    uint16_t first = level_section_first_item(level, s);
+    uint16_t end = first + level_section_num_items(level, s);
+
+    // The confirm item keeps its position: the other items are sorted around it
+    uint16_t confirm = end;
+    for(uint16_t i=first; level->confirm_item && i<end; i++) {
+      if(entries[i].item == level->confirm_item) {
+        confirm = i;
+      }
+    }
+    if(confirm == end) {
+      sort_entries(entries, first, end, key_cb == NULL);
+      continue;
+    }
+
+    SortEntry entry = entries[confirm];
+    memmove(&entries[confirm], &entries[confirm + 1], (end - confirm - 1) * sizeof(SortEntry));
+    sort_entries(entries, first, end - 1, key_cb == NULL);
+    memmove(&entries[confirm + 1], &entries[confirm], (end - confirm - 1) * sizeof(SortEntry));
+    entries[confirm] = entry;
+  }
+
+  for(uint16_t i=0; i<level->num_items; i++) {
+    level->items[i] = entries[i].item;
+    if(level->selection) {
+      if(entries[i].selected)
+        level->selection[i / 8] |= 1 << (i % 8);
+      else
+        level->selection[i / 8] &= ~(1 << (i % 8));
+    }
+  }
+
+  // The measurements follow their items
+  LevelCache *cache = level->cache;
+  if(cache && cache->valid && cache->num_cells == level->num_items) {
+    LevelCache *sorted = level_cache_create(cache->num_cells, cache->num_headers);
+    if(sorted) {
+      sorted->font = cache->font;
+      sorted->font_load = cache->font_load;
+      sorted->header_font = cache->header_font;
+      sorted->width = cache->width;
+      sorted->measure = cache->measure;
+      sorted->valid = true;
+      for(uint16_t i=0; i<level->num_items; i++) {
+        sorted->cell_heights[i] = cache->cell_heights[entries[i].index];
+      }
+      memcpy(sorted->header_heights, cache->header_heights, cache->num_headers * sizeof(int16_t));
+      heap_free(cache);
+      level->cache = sorted;
+    }
+    else {
+      cache->valid = false;
+    }
+  }
+
+  // Keep the open menus showing the level on the same item
+  for(ActionMenu *menu = s_open_menus; menu; menu = menu->next_open) {
+    if(menu->current_level != level || menu->menulayer == NULL)
+      continue;
+
+    uint16_t selected = selected_item_index(menu);
+    for(uint16_t i=0; i<level->num_items; i++) {
+      if(entries[i].index == selected) {
+        selected = i;
+        break;
+      }
+    }
+    refresh_menu(menu, false);
+
+    for(uint16_t s=0; s<level_num_menu_sections(level); s++) {
+      uint16_t first = level_section_first_item(level, s);
+      if(selected >= first && selected < first + level_section_num_items(level, s)) {
+        menu_layer_set_selected_index(menu->menulayer, (MenuIndex){s, selected - first}, MenuRowAlignCenter, false);
+        break;
+      }
+    }
+  }
+
+  heap_free(entries);
+  return true;
+}
+
+//! Sort the items of a level in place, preserving the relative order of equal
+//! items. Items are only sorted within their section, and the confirm item of
+//! a multi-select level keeps its position.
+//! An ActionMenu showing the level keeps the same item selected.
+//! @param level the level to sort
+//! @param mode how to order the items
+//! @return true on success, false if out of memory, the level is a strided one or
+//! it has items performing its default action: their index is all that tells
+//! them apart, which sorting would change
+//! @see action_menu_level_set_default_action
+bool action_menu_level_sort(ActionMenuLevel *level, ActionMenuSortMode mode){
+  switch(mode) {
+    case ActionMenuSortModeLabel:
+      return level_sort(level, NULL, NULL);
+  }
+  return false;
+}
+
+//! Sort the items of a level in place by ascending key, preserving the relative
+//! order of items with equal keys. Items are only sorted within their section,
+//! and the confirm item of a multi-select level keeps its position.
+//! An ActionMenu showing the level keeps the same item selected.
+//! @param level the level to sort
+//! @param key_cb the callback computing the key of an item, called once per item
+//! @param context a context pointer to pass to key_cb
+//! @return true on success, false if out of memory, the level is a strided one or
+//! it has items performing its default action: their index is all that tells
+//! them apart, which sorting would change
+//! @see action_menu_level_set_default_action
+bool action_menu_level_sort_by_key(ActionMenuLevel *level,
+                                   ActionMenuSortKeyCb key_cb,
+                                   void *context){
+  return key_cb ? level_sort(level, key_cb, context) : false;
+}
+
+#if ACTION_MENU_STATS
+//! Get the counters of the session of an ActionMenu, a proxy of its energy use
+//! @param action_menu the ActionMenu
+//! @return the counters, NULL if invalid
+//! @note the counters are complete once the ActionMenu closed: call this from
+//! the did_close callback to report them
+const ActionMenuSessionStats *action_menu_get_session_stats(ActionMenu *action_menu){
+  return action_menu ? &action_menu->session : NULL;
+}
+#endif
@@ -1,7 +1,38 @@
 #pragma once
 
 #include <pebble.h>
-#ifdef PBL_SDK_2
+
+#ifndef PBL_SDK_2
+// SDK3 ships its own ActionMenu: rename this implementation so that the
+// declarations below don't clash with the ones from pebble.h
+#define ActionMenu                      ApliteActionMenu
+#define ActionMenuItem                  ApliteActionMenuItem
+#define ActionMenuLevel                 ApliteActionMenuLevel
+#define ActionMenuAlign                 ApliteActionMenuAlign
+#define ActionMenuAlignTop              ApliteActionMenuAlignTop
+#define ActionMenuAlignCenter           ApliteActionMenuAlignCenter
+#define ActionMenuDidCloseCb            ApliteActionMenuDidCloseCb
+#define ActionMenuLevelDisplayMode      ApliteActionMenuLevelDisplayMode
+#define ActionMenuLevelDisplayModeWide  ApliteActionMenuLevelDisplayModeWide
+#define ActionMenuLevelDisplayModeThin  ApliteActionMenuLevelDisplayModeThin
+#define ActionMenuPerformActionCb       ApliteActionMenuPerformActionCb
+#define ActionMenuEachItemCb            ApliteActionMenuEachItemCb
+#define ActionMenuConfig                ApliteActionMenuConfig
+#define action_menu_item_get_label          aplite_action_menu_item_get_label
+#define action_menu_item_get_action_data    aplite_action_menu_item_get_action_data
+#define action_menu_level_create            aplite_action_menu_level_create
+#define action_menu_level_set_display_mode  aplite_action_menu_level_set_display_mode
+#define action_menu_level_add_action        aplite_action_menu_level_add_action
+#define action_menu_level_add_child         aplite_action_menu_level_add_child
+#define action_menu_hierarchy_destroy       aplite_action_menu_hierarchy_destroy
+#define action_menu_get_context             aplite_action_menu_get_context
+#define action_menu_get_root_level          aplite_action_menu_get_root_level
+#define action_menu_open                    aplite_action_menu_open
+#define action_menu_freeze                  aplite_action_menu_freeze
+#define action_menu_unfreeze                aplite_action_menu_unfreeze
+#define action_menu_set_result_window       aplite_action_menu_set_result_window
+#define action_menu_close                   aplite_action_menu_close
+#endif
 
 //! @addtogroup ActionMenu
 //! @{
@@ -45,11 +76,80 @@ typedef void (*ActionMenuPerformActionCb)(ActionMenu *action_menu,
                                           const ActionMenuItem *action,
                                           void *context);
 
+//! Callback executed when the confirm item of a multi-select level is selected
+//! @param action_menu the action menu currently on screen
+//! @param level the multi-select level
+//! @param selection a bitset of the selected items: item i is selected when
+//! bit (i % 8) of selection[i / 8] is set
+//! @param num_selected the number of selected items
+//! @param context the context passed to the action menu
+//! @see action_menu_level_add_confirm
+typedef void (*ActionMenuMultiSelectCb)(ActionMenu *action_menu,
+                                        const ActionMenuLevel *level,
+                                        const uint8_t *selection,
+                                        uint16_t num_selected,
+                                        void *context);
+
+//! Callback executed when an item without its own callback is selected
+//! @param action_menu the action menu currently on screen
+//! @param action the action that was triggered
+//! @param index the index of the action in its level
+//! @param context the context passed to the action menu
+//! @see action_menu_level_set_default_action
+typedef void (*ActionMenuPerformIndexedActionCb)(ActionMenu *action_menu,
+                                                 const ActionMenuItem *action,
+                                                 uint16_t index,
+                                                 void *context);
+
+//! Orders available to \ref action_menu_level_sort
+typedef enum {
+  ActionMenuSortModeLabel, //!< case-insensitive alphabetical order of the labels
+} ActionMenuSortMode;
+
+//! Callback computing the sort key of an item
+//! @param item the item
+//! @param context the context passed to \ref action_menu_level_sort_by_key
+//! @return the key of the item, items are sorted by ascending keys
+typedef int32_t (*ActionMenuSortKeyCb)(const ActionMenuItem *item, void *context);
+
 //! Callback invoked for each item in an action menu hierarchy.
 //! @param item the current action menu item
 //! @param a caller-provided context callback
 typedef void (*ActionMenuEachItemCb)(const ActionMenuItem *item, void *context);
 
+//! Callback measuring the cell of an item for a custom renderer
+//! @param item the item to measure
+//! @param width the width of the cell
+//! @param font the font selected for the ActionMenu
+//! @param context the context passed to the action menu
+//! @return the height of the cell
+//! @note the result is cached while the level is shown or is an ancestor of the
+//! shown level: this is called once per item when the level is entered, and again
+//! only if the ActionMenu is reloaded
+typedef int16_t (*ActionMenuMeasureItemCb)(const ActionMenuItem *item,
+                                           int16_t width,
+                                           GFont font,
+                                           void *context);
+
+//! Callback drawing the cell of an item for a custom renderer
+//! @param ctx the graphics context
+//! @param cell_layer the layer of the cell, its bounds give the area to draw
+//! @param item the item to draw
+//! @param level the level of the item, e.g. to draw whether the item of a multi-select
+//! level is checked with \ref action_menu_level_is_item_selected
+//! @param index the index of the item in the level
+//! @param selected whether the item is the selected one
+//! @param font the font selected for the ActionMenu
+//! @param context the context passed to the action menu
+typedef void (*ActionMenuDrawItemCb)(GContext *ctx,
+                                     const Layer *cell_layer,
+                                     const ActionMenuItem *item,
+                                     const ActionMenuLevel *level,
+                                     uint16_t index,
+                                     bool selected,
+                                     GFont font,
+                                     void *context);
+
 //! Configuration struct for the ActionMenu
 typedef struct {
   const ActionMenuLevel *root_level; //!< the root level of the ActionMenu
@@ -61,11 +161,92 @@ typedef struct {
   ActionMenuDidCloseCb will_close; //!< Called immediately before the ActionMenu closes
   ActionMenuDidCloseCb did_close; //!< a callback used to cleanup memory after the menu has closed
   ActionMenuAlign align;
+  struct {
+    const char *system_key; //!< key of the system font to use, NULL for the default font
+    uint32_t resource_id; //!< resource id of a custom font, 0 to use a system font.
+                          //!< Custom fonts are loaded once and shared between ActionMenus.
+                          //!< Section headers use the selected font, a smaller system font by default.
+  } font;
+  struct {
+    ActionMenuMeasureItemCb measure; //!< measures a cell, NULL for the built-in measurement
+    ActionMenuDrawItemCb draw; //!< draws a cell, NULL for the built-in look
+  } renderer;
 } ActionMenuConfig;
 
+//! Set the dictionary used to compress the labels of the items added afterwards.
+//! Labels are stored with each occurrence of a dictionary word replaced by a single
+//! byte and decoded into a shared scratch buffer when drawn or requested.
+//! Decoded labels are truncated to 127 characters, labels of strided levels are
+//! never encoded nor truncated.
+//! @param words the dictionary words, e.g. the most frequent words of the label corpus
+//! built by a host tool. The array must stay valid as long as any level exists.
+//! @param num_words the number of words, at most 16. Pass 0 to disable compression.
+//! @return true on success, false if labels are stored: the dictionary can only change
+//! before any label is added or once every hierarchy is destroyed
+//! @note labels containing the bytes 0x10-0x1F are refused while a dictionary is set
+bool action_menu_set_label_dictionary(const char *const *words, uint8_t num_words);
+
+// Gather the latency and session statistics, 0 to compile them out
+#ifndef ACTION_MENU_STATS
+#define ACTION_MENU_STATS 1
+#endif
+
+#if ACTION_MENU_STATS
+//! Number of buckets of an \ref ActionMenuLatencyHistogram
+#define ACTION_MENU_LATENCY_BUCKETS 8
+
+//! Histogram of latencies: bucket i counts the latencies below (16 << i) ms
+//! not counted by the previous buckets, the last bucket counts the remaining ones
+typedef struct {
+  uint16_t buckets[ACTION_MENU_LATENCY_BUCKETS];
+} ActionMenuLatencyHistogram;
+
+//! Latency statistics gathered by the ActionMenus
+typedef struct {
+  ActionMenuLatencyHistogram click_to_redraw; //!< from a button press to the next frame
+  ActionMenuLatencyHistogram select_to_action_done; //!< from SELECT to the return of the action callback
+  ActionMenuLatencyHistogram back_to_level_shown; //!< from BACK to the end of the transition to the parent level
+  uint16_t slow_callbacks; //!< number of user callbacks which exceeded the slow callback threshold
+  uint16_t slowest_callback_ms; //!< duration of the slowest user callback
+} ActionMenuStats;
+
+//! Counters of the work done by an ActionMenu from opening to closing, used as
+//! a proxy for its energy use
+typedef struct {
+  uint32_t frames; //!< frames rendered
+  uint32_t animation_frames; //!< frames rendered during level transitions
+  uint32_t text_draws; //!< text runs drawn by the built-in renderer
+  uint32_t text_measurements; //!< texts measured by the built-in renderer
+  uint32_t heap_operations; //!< allocations and frees done by the library during the session,
+                            //!< including its windows, layers, animations, bitmaps and fonts
+  uint32_t on_screen_ms; //!< time the ActionMenu was visible
+} ActionMenuSessionStats;
+#endif
+
+#if ACTION_MENU_STATS
+//! Get the latency statistics gathered by every ActionMenu since the app started
+//! or since the last \ref action_menu_reset_stats
+//! @return the statistics
+const ActionMenuStats *action_menu_get_stats(void);
+
+//! Clear the latency statistics
+void action_menu_reset_stats(void);
+
+//! Set the duration above which a user callback called by the ActionMenu is
+//! logged as a warning and counted in \ref ActionMenuStats.
+//! @param threshold_ms the threshold in milliseconds (100 by default), 0 to disable the warnings
+void action_menu_set_slow_callback_threshold(uint16_t threshold_ms);
+#endif
+
+//! Unload the cached custom fonts which are not used by an open ActionMenu.
+//! @note call this when the app is running low on memory
+void action_menu_font_cache_trim(void);
+
 //! Getter for the label of a given \ref ActionMenuItem
 //! @param item the \ref ActionMenuItem of interest
 //! @return a pointer to the string label. NULL if invalid.
+//! @note when a label dictionary is set, the label of an item added to a level is
+//! decoded into a shared buffer which is only valid until the next call
 char *action_menu_item_get_label(const ActionMenuItem *item);
 
 //! Getter for the action_data pointer of a given \ref ActionMenuitem.
@@ -82,6 +263,23 @@ void *action_menu_item_get_action_data(const ActionMenuItem *item);
 //! @see action_menu_hierarchy_destroy
 ActionMenuLevel *action_menu_level_create(uint16_t num_items);
 
+//! Create a level displaying the elements of an array owned by the app, without
+//! allocating any \ref ActionMenuItem or label
+//! @param base the first element of the array
+//! @param count the number of elements
+//! @param stride the size of an element, i.e. sizeof the element struct
+//! @param label_offset the offset of the label in an element, which must be a NUL
+//! terminated char array member, e.g. offsetof(Contact, name)
+//! @param cb the callback triggered when any element is actuated. The \ref ActionMenuItem
+//! it receives has the label of the element and the element as action_data.
+//! @note the array must not change while the level exists
+//! @see action_menu_level_create
+ActionMenuLevel *action_menu_level_create_strided(const void *base,
+                                                  uint16_t count,
+                                                  size_t stride,
+                                                  size_t label_offset,
+                                                  ActionMenuPerformActionCb cb);
+
 //! Set the action menu display mode
 //! @param level The ActionMenuLevel whose display mode you want to change
 //! @param display_mode The display mode for the action menu (3 vs. 1 item per row)
@@ -93,27 +291,126 @@ void action_menu_level_set_display_mode(ActionMenuLevel *level,
 //! @param label the text to display for the action in the menu
 //! @param cb the callback that will be triggered when this action is actuated
 //! @param action_data data to pass to the callback for this action
-//! @return a reference to the new \ref ActionMenuItem on success, NULL if the level is full
+//! @return a reference to the new \ref ActionMenuItem on success, NULL if the level is full,
+//! out of memory or the label is invalid (see \ref action_menu_set_label_dictionary)
 ActionMenuItem *action_menu_level_add_action(ActionMenuLevel *level,
                                              const char *label,
                                              ActionMenuPerformActionCb cb,
                                              void *action_data);
 
+//! Add an item without callback nor action data to an ActionLevel. The item
+//! only stores its label, which makes it about half the size of an action:
+//! actuating it calls the level default action with the index of the item.
+//! @param level the level to add the item to
+//! @param label the text to display for the item in the menu
+//! @return a reference to the new \ref ActionMenuItem on success, NULL if the level is full,
+//! out of memory or the label is invalid (see \ref action_menu_set_label_dictionary)
+//! @note such items can't have a secondary (long press) action
+//! @see action_menu_level_set_default_action
+ActionMenuItem *action_menu_level_add_item(ActionMenuLevel *level,
+                                           const char *label);
+
+//! Reserve inline storage for the action data of the items added afterwards to a level.
+//! The storage is allocated together with each item and freed with it, so small
+//! payloads need neither a separate allocation nor cleanup in
+//! \ref action_menu_hierarchy_destroy.
+//! @param level the level
+//! @param size the number of bytes reserved per item, 0 to store action_data pointers again
+//! @note with inline storage, \ref action_menu_level_add_action copies size bytes from
+//! its action_data argument (if not NULL, zeroed otherwise) and
+//! \ref action_menu_item_get_action_data returns the inline copy
+void action_menu_level_set_inline_data_size(ActionMenuLevel *level, uint8_t size);
+
+//! Set the default action of a level, performed for the items without their own callback
+//! @param level the level
+//! @param cb the callback triggered with the index of the actuated item, NULL to remove it
+void action_menu_level_set_default_action(ActionMenuLevel *level,
+                                          ActionMenuPerformIndexedActionCb cb);
+
+//! Set the secondary action of an item, performed when SELECT is long pressed
+//! @param item the item, typically returned by \ref action_menu_level_add_action
+//! @param cb the callback triggered on long press, NULL to remove it.
+//! It receives the item like its regular action does.
+//! @note long pressing an item without secondary action performs its regular action
+void action_menu_item_set_long_press_action(ActionMenuItem *item,
+                                            ActionMenuPerformActionCb cb);
+
+//! Add the confirm item of a multi-select level. Adding it switches the level
+//! to multi-select mode: SELECT on any other item without child toggles its
+//! selection, and SELECT on the confirm item performs a single action for all
+//! the selected items.
+//! @param level the level to add the confirm item to
+//! @param label the text to display for the confirm item
+//! @param cb the callback triggered with the selection when the confirm item is actuated
+//! @return a reference to the new \ref ActionMenuItem on success, NULL if the level is full,
+//! out of memory or the label is invalid (see \ref action_menu_set_label_dictionary)
+//! or already has a confirm item
+//! @note the selection is cleared once the callback returns
+ActionMenuItem *action_menu_level_add_confirm(ActionMenuLevel *level,
+                                              const char *label,
+                                              ActionMenuMultiSelectCb cb);
+
+//! Whether an item of a multi-select level is selected
+//! @param level the level
+//! @param index the index of the item in the level
+//! @return true if the item is selected, false otherwise or if the level isn't a multi-select one
+bool action_menu_level_is_item_selected(const ActionMenuLevel *level, uint16_t index);
+
+//! Start a new section in an ActionMenuLevel. The items added afterwards are
+//! grouped under a header showing the given label, until the next section starts.
+//! Long pressing UP or DOWN jumps to the previous or next section. Menus whose
+//! hierarchy has no section don't subscribe to the long presses, so that
+//! UP and DOWN respond on press.
+//! @param level the level to add the section to
+//! @param label the text to display in the section header
+//! @return true on success, false if out of memory or the label is invalid
+//! (see \ref action_menu_set_label_dictionary)
+bool action_menu_level_add_section(ActionMenuLevel *level, const char *label);
+
 //! Add a child to this ActionMenuLevel
 //! @param level the parent level
 //! @param child the child level
 //! @param label the text to display in the action menu for this level
-//! @return a reference to the new \ref ActionMenuItem on success, NULL if the level is full
+//! @return a reference to the new \ref ActionMenuItem on success, NULL if the level is full,
+//! out of memory or the label is invalid (see \ref action_menu_set_label_dictionary)
 ActionMenuItem *action_menu_level_add_child(ActionMenuLevel *level,
                                             ActionMenuLevel *child,
                                             const char *label);
 
+//! Sort the items of a level in place, preserving the relative order of equal
+//! items. Items are only sorted within their section, and the confirm item of
+//! a multi-select level keeps its position.
+//! An ActionMenu showing the level keeps the same item selected.
+//! @param level the level to sort
+//! @param mode how to order the items
+//! @return true on success, false if out of memory, the level is a strided one or
+//! it has items performing its default action: their index is all that tells
+//! them apart, which sorting would change
+//! @see action_menu_level_set_default_action
+bool action_menu_level_sort(ActionMenuLevel *level, ActionMenuSortMode mode);
+
+//! Sort the items of a level in place by ascending key, preserving the relative
+//! order of items with equal keys. Items are only sorted within their section,
+//! and the confirm item of a multi-select level keeps its position.
+//! An ActionMenu showing the level keeps the same item selected.
+//! @param level the level to sort
+//! @param key_cb the callback computing the key of an item, called once per item
+//! @param context a context pointer to pass to key_cb
+//! @return true on success, false if out of memory, the level is a strided one or
+//! it has items performing its default action: their index is all that tells
+//! them apart, which sorting would change
+//! @see action_menu_level_set_default_action
+bool action_menu_level_sort_by_key(ActionMenuLevel *level,
+                                   ActionMenuSortKeyCb key_cb,
+                                   void *context);
+
 //! Destroy a hierarchy of ActionMenuLevels
 //! @param root the root level in the hierarchy
 //! @param each_cb a callback to call on every \ref ActionMenuItem in every level
 //! @param context a context pointer to pass to each_cb on invocation
-//! @note Typical implementations will cleanup memory allocated for the item label/data
-//!       associated with each item in the callback
+//! @note Typical implementations will cleanup memory allocated for the action data
+//!       associated with each item in the callback. Labels are owned and freed by the
+//!       library once the callback returns: the callback may read them but must not free them.
 //! @note Hierarchy is traversed in post-order.
 //!       In other words, all children items are freed before their parent is freed.
 void action_menu_hierarchy_destroy(const ActionMenuLevel *root,
@@ -134,7 +431,7 @@ ActionMenuLevel *action_menu_get_root_level(ActionMenu *action_menu);
 //! Open a new ActionMenu.
 //! The ActionMenu acts much like a window. It fills the whole screen and handles clicks.
 //! @param config the configuration info for this new ActionMenu
-//! @return the new ActionMenu
+//! @return the new ActionMenu, NULL if out of memory; its callbacks are then never called
 ActionMenu *action_menu_open(ActionMenuConfig *config);
 
 //! Freeze the ActionMenu. The ActionMenu will no longer respond to user input.
@@ -161,6 +458,20 @@ void action_menu_set_result_window(ActionMenu *action_menu, Window *result_windo
 //! @param animated whether or not show a close animation
 void action_menu_close(ActionMenu *action_menu, bool animated);
 
-//! @} // group ActionMenu
+#if ACTION_MENU_STATS
+//! Get the counters of the session of an ActionMenu, a proxy of its energy use
+//! @param action_menu the ActionMenu
+//! @return the counters, NULL if invalid
+//! @note the counters are complete once the ActionMenu closed: call this from
+//! the did_close callback to report them
+const ActionMenuSessionStats *action_menu_get_session_stats(ActionMenu *action_menu);
+#endif
 
-#endif
\ No newline at end of file
+//! Reload the ActionMenu after labels or items of the displayed hierarchy changed.
+//! @note while the ActionMenu is hidden (e.g. covered by a result window or a
+//! notification) the reload is deferred and coalesced into a single refresh
+//! applied when the ActionMenu appears again
+//! @param action_menu the ActionMenu to reload
+void action_menu_reload(ActionMenu *action_menu);
+
+//! @} // group ActionMenu
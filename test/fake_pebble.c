@@ -0,0 +1,751 @@
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "fake_pebble.h"
+
+#ifdef PBL_ROUND
+#define DEFAULT_SCREEN_W 180
+#define DEFAULT_SCREEN_H 180
+#else
+#define DEFAULT_SCREEN_W 144
+#define DEFAULT_SCREEN_H 168
+#endif
+
+#define MAX_WINDOWS      8
+#define MAX_ANIMATIONS   16
+#define MAX_CUSTOM_FONTS 4
+
+struct GContext {
+  GColor fill_color;
+  GColor text_color;
+};
+
+struct GBitmap {
+  const uint8_t *data;
+};
+
+struct Layer {
+  GRect frame;
+  GRect bounds;
+  LayerUpdateProc update_proc;
+  Layer *parent;
+  Layer *first_child;
+  Layer *next_sibling;
+  MenuLayer *menu_layer;
+  void *data;
+};
+
+struct MenuLayer {
+  Layer *layer;
+  MenuLayerCallbacks callbacks;
+  void *context;
+  MenuIndex selected;
+};
+
+struct Window {
+  Layer *root;
+  WindowHandlers handlers;
+  void *user_data;
+  ClickConfigProvider click_config_provider;
+  void *click_context;
+  ClickHandler single_click[NUM_BUTTONS];
+  ClickHandler long_click[NUM_BUTTONS];
+  bool loaded;
+};
+
+struct Animation {
+  Layer *layer;
+  GRect to_frame;
+  AnimationHandlers handlers;
+  void *context;
+  bool scheduled;
+};
+
+FakePebbleStats fake_pebble;
+bool (*fake_pebble_allocation_fails)(void);
+
+static struct FakeFont s_system_font = {FAKE_SYSTEM_CHAR_WIDTH, FAKE_SYSTEM_LINE_HEIGHT, FAKE_SYSTEM_LINE_PITCH};
+static struct FakeFont s_small_font = {FAKE_SMALL_CHAR_WIDTH, FAKE_SMALL_LINE_HEIGHT, FAKE_SMALL_LINE_PITCH};
+// Loaded custom fonts get the first free entry, like a heap reusing the block
+// of the last unloaded font
+static struct FakeFont s_custom_fonts[MAX_CUSTOM_FONTS];
+static bool s_custom_font_loaded[MAX_CUSTOM_FONTS];
+static struct GContext s_context;
+static GSize s_screen = {DEFAULT_SCREEN_W, DEFAULT_SCREEN_H};
+static uint32_t s_now_ms = 1000000;
+static int s_live_objects;
+
+static Window *s_stack[MAX_WINDOWS];
+static int s_stack_size;
+static Window *s_pending_unload[MAX_WINDOWS];
+static int s_num_pending_unload;
+static Window *s_subscribing;
+
+static Animation *s_animations[MAX_ANIMATIONS];
+
+//! Whether the creation of an SDK object fails, as decided by the test hook
+static bool allocation_fails(void) {
+  return fake_pebble_allocation_fails && fake_pebble_allocation_fails();
+}
+
+void fake_pebble_reset(void) {
+  memset(&fake_pebble, 0, sizeof(fake_pebble));
+  s_screen = (GSize){DEFAULT_SCREEN_W, DEFAULT_SCREEN_H};
+}
+
+void fake_pebble_set_screen_size(int16_t w, int16_t h) {
+  s_screen = (GSize){w, h};
+}
+
+void fake_pebble_advance_time(uint32_t ms) {
+  s_now_ms += ms;
+}
+
+int fake_pebble_live_objects(void) {
+  return s_live_objects;
+}
+
+void app_log(uint8_t log_level, const char *src_filename, int src_line_number, const char *fmt, ...) {
+  fake_pebble.logs++;
+}
+
+uint16_t time_ms(time_t *t_utc, uint16_t *out_ms) {
+  if(t_utc) {
+    *t_utc = s_now_ms / 1000;
+  }
+  if(out_ms) {
+    *out_ms = s_now_ms % 1000;
+  }
+  return s_now_ms % 1000;
+}
+
+// Fonts and text
+
+ResHandle resource_get_handle(uint32_t resource_id) {
+  return (ResHandle)(uintptr_t)resource_id;
+}
+
+GFont fonts_get_system_font(const char *font_key) {
+  return strcmp(font_key, FONT_KEY_GOTHIC_18_BOLD) == 0 ? &s_small_font : &s_system_font;
+}
+
+GFont fonts_load_custom_font(ResHandle handle) {
+  if((uintptr_t)handle == FAKE_MISSING_FONT_RESOURCE || allocation_fails()) {
+    return NULL;
+  }
+  for(int i = 0; i < MAX_CUSTOM_FONTS; i++) {
+    if(!s_custom_font_loaded[i]) {
+      s_custom_font_loaded[i] = true;
+      s_custom_fonts[i] = (uintptr_t)handle == FAKE_BIG_FONT_RESOURCE
+        ? (struct FakeFont){FAKE_BIG_CHAR_WIDTH, FAKE_BIG_LINE_HEIGHT, FAKE_BIG_LINE_PITCH}
+        : (struct FakeFont){FAKE_CUSTOM_CHAR_WIDTH, FAKE_CUSTOM_LINE_HEIGHT, FAKE_CUSTOM_LINE_PITCH};
+      fake_pebble.font_loads++;
+      s_live_objects++;
+      return &s_custom_fonts[i];
+    }
+  }
+  return NULL;
+}
+
+void fonts_unload_custom_font(GFont font) {
+  for(int i = 0; i < MAX_CUSTOM_FONTS; i++) {
+    if(font == &s_custom_fonts[i] && s_custom_font_loaded[i]) {
+      s_custom_font_loaded[i] = false;
+      s_live_objects--;
+      return;
+    }
+  }
+}
+
+//! Greedy word wrap: lines break at spaces and newlines, words wider than
+//! the box are broken anywhere
+static GSize text_layout(const char *text, GFont font, int16_t width, int *num_lines) {
+  int lines = 0;
+  int line_width = 0;
+  int max_width = 0;
+  bool line_open = false;
+
+  for(const char *c = text; c && *c; ) {
+    if(*c == '\n') {
+      lines++;
+      line_open = false;
+      line_width = 0;
+      c++;
+      continue;
+    }
+    if(*c == ' ') {
+      c++;
+      continue;
+    }
+
+    const char *end = c;
+    while(*end && *end != ' ' && *end != '\n')
+      end++;
+    int word_width = (int)(end - c) * font->char_width;
+
+    if(line_open && line_width + font->char_width + word_width <= width) {
+      line_width += font->char_width + word_width;
+    }
+    else {
+      if(line_open) {
+        lines++;
+      }
+      while(word_width > width) {
+        lines++;
+        word_width -= width;
+      }
+      line_open = true;
+      line_width = word_width;
+    }
+    if(line_width > max_width) {
+      max_width = line_width;
+    }
+    c = end;
+  }
+  lines += line_open ? 1 : 0;
+
+  if(num_lines) {
+    *num_lines = lines;
+  }
+  int16_t height = lines ? font->line_height + (lines - 1) * font->line_pitch : 0;
+  return (GSize){max_width > width ? width : max_width, height};
+}
+
+int fake_pebble_text_lines(const char *text, GFont font, int16_t width) {
+  int lines;
+  text_layout(text, font, width, &lines);
+  return lines;
+}
+
+GSize graphics_text_layout_get_content_size(const char *text, GFont font, GRect box,
+                                            GTextOverflowMode overflow_mode, GTextAlignment alignment) {
+  fake_pebble.layout_calls++;
+  return text_layout(text, font, box.size.w, NULL);
+}
+
+void graphics_draw_text(GContext *ctx, const char *text, GFont font, GRect box,
+                        GTextOverflowMode overflow_mode, GTextAlignment alignment,
+                        GTextAttributes *text_attributes) {
+  fake_pebble.text_draws++;
+}
+
+// Graphics
+
+void graphics_context_set_fill_color(GContext *ctx, GColor color) {
+  ctx->fill_color = color;
+}
+
+void graphics_context_set_stroke_color(GContext *ctx, GColor color) {
+}
+
+void graphics_context_set_text_color(GContext *ctx, GColor color) {
+  ctx->text_color = color;
+}
+
+void graphics_fill_rect(GContext *ctx, GRect rect, uint16_t corner_radius, GCornerMask corner_mask) {
+}
+
+void graphics_draw_rect(GContext *ctx, GRect rect) {
+}
+
+void graphics_fill_circle(GContext *ctx, GPoint p, uint16_t radius) {
+}
+
+void graphics_draw_bitmap_in_rect(GContext *ctx, const GBitmap *bitmap, GRect rect) {
+}
+
+GBitmap *gbitmap_create_with_data(const uint8_t *data) {
+  if(allocation_fails())
+    return NULL;
+
+  GBitmap *bitmap = malloc(sizeof(GBitmap));
+  bitmap->data = data;
+  s_live_objects++;
+  return bitmap;
+}
+
+void gbitmap_destroy(GBitmap *bitmap) {
+  if(bitmap) {
+    s_live_objects--;
+    free(bitmap);
+  }
+}
+
+// Layers
+
+Layer *layer_create_with_data(GRect frame, size_t data_size) {
+  if(allocation_fails())
+    return NULL;
+
+  Layer *layer = calloc(1, sizeof(Layer) + data_size);
+  layer->frame = frame;
+  layer->bounds = (GRect){{0, 0}, frame.size};
+  layer->data = layer + 1;
+  s_live_objects++;
+  return layer;
+}
+
+Layer *layer_create(GRect frame) {
+  return layer_create_with_data(frame, 0);
+}
+
+static void layer_remove_from_parent(Layer *layer) {
+  if(layer->parent == NULL)
+    return;
+
+  for(Layer **it = &layer->parent->first_child; *it; it = &(*it)->next_sibling) {
+    if(*it == layer) {
+      *it = layer->next_sibling;
+      break;
+    }
+  }
+  layer->parent = NULL;
+  layer->next_sibling = NULL;
+}
+
+void layer_destroy(Layer *layer) {
+  if(layer == NULL)
+    return;
+
+  layer_remove_from_parent(layer);
+  for(Layer *child = layer->first_child; child; ) {
+    Layer *next = child->next_sibling;
+    child->parent = NULL;
+    child->next_sibling = NULL;
+    child = next;
+  }
+  s_live_objects--;
+  free(layer);
+}
+
+void *layer_get_data(const Layer *layer) {
+  return layer->data;
+}
+
+GRect layer_get_frame(const Layer *layer) {
+  return layer->frame;
+}
+
+void layer_set_frame(Layer *layer, GRect frame) {
+  layer->frame = frame;
+  layer->bounds.size = frame.size;
+}
+
+GRect layer_get_bounds(const Layer *layer) {
+  return layer->bounds;
+}
+
+void layer_set_update_proc(Layer *layer, LayerUpdateProc update_proc) {
+  layer->update_proc = update_proc;
+}
+
+void layer_add_child(Layer *parent, Layer *child) {
+  layer_remove_from_parent(child);
+  child->parent = parent;
+  Layer **it = &parent->first_child;
+  while(*it)
+    it = &(*it)->next_sibling;
+  *it = child;
+}
+
+void layer_mark_dirty(Layer *layer) {
+}
+
+// Menu layers
+
+MenuLayer *menu_layer_create(GRect frame) {
+  if(allocation_fails())
+    return NULL;
+
+  MenuLayer *menu_layer = calloc(1, sizeof(MenuLayer));
+  menu_layer->layer = layer_create(frame);
+  if(menu_layer->layer == NULL) {
+    free(menu_layer);
+    return NULL;
+  }
+  menu_layer->layer->menu_layer = menu_layer;
+  s_live_objects++;
+  return menu_layer;
+}
+
+void menu_layer_destroy(MenuLayer *menu_layer) {
+  if(menu_layer == NULL)
+    return;
+
+  layer_destroy(menu_layer->layer);
+  s_live_objects--;
+  free(menu_layer);
+}
+
+Layer *menu_layer_get_layer(const MenuLayer *menu_layer) {
+  return menu_layer->layer;
+}
+
+void menu_layer_set_callbacks(MenuLayer *menu_layer, void *callback_context, MenuLayerCallbacks callbacks) {
+  menu_layer->callbacks = callbacks;
+  menu_layer->context = callback_context;
+}
+
+static uint16_t menu_num_sections(MenuLayer *menu_layer) {
+  return menu_layer->callbacks.get_num_sections
+         ? menu_layer->callbacks.get_num_sections(menu_layer, menu_layer->context) : 1;
+}
+
+static uint16_t menu_num_rows(MenuLayer *menu_layer, uint16_t section) {
+  return menu_layer->callbacks.get_num_rows(menu_layer, section, menu_layer->context);
+}
+
+static int16_t menu_header_height(MenuLayer *menu_layer, uint16_t section) {
+  fake_pebble.height_queries++;
+  return menu_layer->callbacks.get_header_height
+         ? menu_layer->callbacks.get_header_height(menu_layer, section, menu_layer->context) : 0;
+}
+
+static int16_t menu_cell_height(MenuLayer *menu_layer, MenuIndex *index) {
+  fake_pebble.height_queries++;
+  return menu_layer->callbacks.get_cell_height
+         ? menu_layer->callbacks.get_cell_height(menu_layer, index, menu_layer->context) : 44;
+}
+
+//! Move the selection to a valid row, the first one after it if needed
+static void menu_clamp_selection(MenuLayer *menu_layer) {
+  uint16_t num_sections = menu_num_sections(menu_layer);
+  MenuIndex *selected = &menu_layer->selected;
+  while(selected->section < num_sections && selected->row >= menu_num_rows(menu_layer, selected->section)) {
+    selected->section++;
+    selected->row = 0;
+  }
+  if(selected->section >= num_sections) {
+    *selected = (MenuIndex){0, 0};
+  }
+}
+
+void menu_layer_reload_data(MenuLayer *menu_layer) {
+  fake_pebble.reloads++;
+
+  // The content size depends on the height of every header and cell
+  uint16_t num_sections = menu_num_sections(menu_layer);
+  for(uint16_t s = 0; s < num_sections; s++) {
+    menu_header_height(menu_layer, s);
+    for(uint16_t r = 0; r < menu_num_rows(menu_layer, s); r++) {
+      menu_cell_height(menu_layer, &(MenuIndex){s, r});
+    }
+  }
+  menu_clamp_selection(menu_layer);
+}
+
+MenuIndex menu_layer_get_selected_index(const MenuLayer *menu_layer) {
+  return menu_layer->selected;
+}
+
+void menu_layer_set_selected_index(MenuLayer *menu_layer, MenuIndex index, MenuRowAlign scroll_align, bool animated) {
+  menu_layer->selected = index;
+  menu_clamp_selection(menu_layer);
+}
+
+void menu_layer_set_selected_next(MenuLayer *menu_layer, bool up, MenuRowAlign scroll_align, bool animated) {
+  MenuIndex index = menu_layer->selected;
+  if(up) {
+    while(index.row == 0) {
+      if(index.section == 0)
+        return;
+      index.section--;
+      index.row = menu_num_rows(menu_layer, index.section);
+    }
+    index.row--;
+  }
+  else {
+    uint16_t num_sections = menu_num_sections(menu_layer);
+    index.row++;
+    while(index.row >= menu_num_rows(menu_layer, index.section)) {
+      if(index.section + 1 >= num_sections)
+        return;
+      index.section++;
+      index.row = 0;
+    }
+  }
+  menu_layer->selected = index;
+}
+
+static void menu_layer_render(MenuLayer *menu_layer) {
+  uint16_t num_sections = menu_num_sections(menu_layer);
+  int16_t width = menu_layer->layer->bounds.size.w;
+  for(uint16_t s = 0; s < num_sections; s++) {
+    int16_t header_height = menu_header_height(menu_layer, s);
+    if(header_height > 0 && menu_layer->callbacks.draw_header) {
+      Layer cell = {.frame = GRect(0, 0, width, header_height), .bounds = GRect(0, 0, width, header_height)};
+      menu_layer->callbacks.draw_header(&s_context, &cell, s, menu_layer->context);
+    }
+    for(uint16_t r = 0; r < menu_num_rows(menu_layer, s); r++) {
+      MenuIndex index = {s, r};
+      int16_t height = menu_cell_height(menu_layer, &index);
+      Layer cell = {.frame = GRect(0, 0, width, height), .bounds = GRect(0, 0, width, height)};
+      menu_layer->callbacks.draw_row(&s_context, &cell, &index, menu_layer->context);
+    }
+  }
+}
+
+static void layer_render(Layer *layer) {
+  if(layer->menu_layer) {
+    menu_layer_render(layer->menu_layer);
+  }
+  else if(layer->update_proc) {
+    layer->update_proc(layer, &s_context);
+  }
+  for(Layer *child = layer->first_child; child; child = child->next_sibling) {
+    layer_render(child);
+  }
+}
+
+// Animations
+
+PropertyAnimation *property_animation_create_layer_frame(Layer *layer, GRect *from_frame, GRect *to_frame) {
+  if(allocation_fails())
+    return NULL;
+
+  for(int i = 0; i < MAX_ANIMATIONS; i++) {
+    if(s_animations[i] == NULL) {
+      Animation *animation = calloc(1, sizeof(Animation));
+      animation->layer = layer;
+      animation->to_frame = to_frame ? *to_frame : layer->frame;
+      if(from_frame) {
+        layer_set_frame(layer, *from_frame);
+      }
+      s_animations[i] = animation;
+      s_live_objects++;
+      return animation;
+    }
+  }
+  return NULL;
+}
+
+void property_animation_destroy(PropertyAnimation *property_animation) {
+  for(int i = 0; i < MAX_ANIMATIONS; i++) {
+    if(s_animations[i] == property_animation) {
+      s_animations[i] = NULL;
+      s_live_objects--;
+      free(property_animation);
+      return;
+    }
+  }
+  fake_pebble.invalid_destroys++;
+}
+
+//! Call the stopped handler of an animation. SDK3 destroys the animation
+//! once the handler returns, SDK2 leaves it to the app.
+static void animation_stopped(Animation *animation, bool finished) {
+  animation->scheduled = false;
+  if(animation->handlers.stopped) {
+    animation->handlers.stopped(animation, finished, animation->context);
+  }
+#ifndef PBL_SDK_2
+  property_animation_destroy(animation);
+#endif
+}
+
+void animation_set_duration(Animation *animation, uint32_t duration_ms) {
+}
+
+void animation_set_curve(Animation *animation, AnimationCurve curve) {
+}
+
+void animation_set_handlers(Animation *animation, AnimationHandlers callbacks, void *context) {
+  animation->handlers = callbacks;
+  animation->context = context;
+}
+
+void animation_schedule(Animation *animation) {
+  animation->scheduled = true;
+}
+
+void animation_unschedule(Animation *animation) {
+  if(!animation->scheduled)
+    return;
+
+  animation_stopped(animation, false);
+}
+
+bool animation_is_scheduled(Animation *animation) {
+  return animation->scheduled;
+}
+
+void fake_pebble_run_animations(void) {
+  bool ran = true;
+  while(ran) {
+    ran = false;
+    for(int i = 0; i < MAX_ANIMATIONS; i++) {
+      Animation *animation = s_animations[i];
+      if(animation && animation->scheduled) {
+        layer_set_frame(animation->layer, animation->to_frame);
+        animation_stopped(animation, true);
+        ran = true;
+        break;
+      }
+    }
+  }
+}
+
+// Windows
+
+Window *window_create(void) {
+  if(allocation_fails())
+    return NULL;
+
+  Window *window = calloc(1, sizeof(Window));
+  window->root = layer_create(GRect(0, 0, s_screen.w, s_screen.h));
+  if(window->root == NULL) {
+    free(window);
+    return NULL;
+  }
+  s_live_objects++;
+  return window;
+}
+
+void window_destroy(Window *window) {
+  if(window == NULL)
+    return;
+
+  for(int i = 0; i < s_num_pending_unload; i++) {
+    if(s_pending_unload[i] == window) {
+      s_pending_unload[i] = NULL;
+    }
+  }
+  layer_destroy(window->root);
+  s_live_objects--;
+  free(window);
+}
+
+Layer *window_get_root_layer(const Window *window) {
+  return window->root;
+}
+
+void window_set_user_data(Window *window, void *data) {
+  window->user_data = data;
+}
+
+void *window_get_user_data(const Window *window) {
+  return window->user_data;
+}
+
+void window_set_window_handlers(Window *window, WindowHandlers handlers) {
+  window->handlers = handlers;
+}
+
+void window_set_click_config_provider_with_context(Window *window, ClickConfigProvider click_config_provider, void *context) {
+  window->click_config_provider = click_config_provider;
+  window->click_context = context;
+}
+
+void window_set_background_color(Window *window, GColor background_color) {
+}
+
+void window_set_fullscreen(Window *window, bool enabled) {
+}
+
+void window_single_click_subscribe(ButtonId button_id, ClickHandler handler) {
+  if(s_subscribing) {
+    s_subscribing->single_click[button_id] = handler;
+  }
+}
+
+void window_long_click_subscribe(ButtonId button_id, uint16_t delay_ms, ClickHandler down_handler, ClickHandler up_handler) {
+  if(s_subscribing) {
+    s_subscribing->long_click[button_id] = down_handler;
+  }
+}
+
+static void window_appear(Window *window) {
+  memset(window->single_click, 0, sizeof(window->single_click));
+  memset(window->long_click, 0, sizeof(window->long_click));
+  if(window->click_config_provider) {
+    s_subscribing = window;
+    window->click_config_provider(window->click_context);
+    s_subscribing = NULL;
+  }
+  if(window->handlers.appear) {
+    window->handlers.appear(window);
+  }
+}
+
+void window_stack_push(Window *window, bool animated) {
+  if(s_stack_size == MAX_WINDOWS)
+    return;
+
+  if(s_stack_size && s_stack[s_stack_size - 1]->handlers.disappear) {
+    s_stack[s_stack_size - 1]->handlers.disappear(s_stack[s_stack_size - 1]);
+  }
+  s_stack[s_stack_size++] = window;
+  if(!window->loaded) {
+    window->loaded = true;
+    if(window->handlers.load) {
+      window->handlers.load(window);
+    }
+  }
+  window_appear(window);
+}
+
+bool window_stack_remove(Window *window, bool animated) {
+  int index = -1;
+  for(int i = 0; i < s_stack_size; i++) {
+    if(s_stack[i] == window) {
+      index = i;
+    }
+  }
+  if(index < 0)
+    return false;
+
+  bool top = index == s_stack_size - 1;
+  if(top && window->handlers.disappear) {
+    window->handlers.disappear(window);
+  }
+  memmove(&s_stack[index], &s_stack[index + 1], (s_stack_size - index - 1) * sizeof(Window *));
+  s_stack_size--;
+  if(top && s_stack_size) {
+    window_appear(s_stack[s_stack_size - 1]);
+  }
+
+  // Windows are unloaded once the transition is over
+  if(s_num_pending_unload < MAX_WINDOWS) {
+    s_pending_unload[s_num_pending_unload++] = window;
+  }
+  return true;
+}
+
+Window *fake_pebble_top_window(void) {
+  return s_stack_size ? s_stack[s_stack_size - 1] : NULL;
+}
+
+void fake_pebble_click(ButtonId button) {
+  Window *window = fake_pebble_top_window();
+  if(window && window->single_click[button]) {
+    window->single_click[button](NULL, window->click_context);
+  }
+}
+
+void fake_pebble_long_click(ButtonId button) {
+  Window *window = fake_pebble_top_window();
+  if(window && window->long_click[button]) {
+    window->long_click[button](NULL, window->click_context);
+  }
+}
+
+void fake_pebble_process_events(void) {
+  fake_pebble_run_animations();
+
+  while(s_num_pending_unload) {
+    Window *window = s_pending_unload[--s_num_pending_unload];
+    if(window && window->loaded) {
+      window->loaded = false;
+      if(window->handlers.unload) {
+        window->handlers.unload(window);
+      }
+    }
+  }
+}
+
+void fake_pebble_render(void) {
+  Window *window = fake_pebble_top_window();
+  if(window) {
+    layer_render(window->root);
+  }
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+// Controls and observations of the fake SDK behind test/pebble.h
+
+#include <pebble.h>
+
+// Text model of the fake fonts: every character is char_width wide, a single
+// line is line_height high and each additional line adds line_pitch
+struct FakeFont {
+  int16_t char_width;
+  int16_t line_height;
+  int16_t line_pitch;
+};
+
+#define FAKE_SYSTEM_CHAR_WIDTH   10
+#define FAKE_SYSTEM_LINE_HEIGHT  22
+#define FAKE_SYSTEM_LINE_PITCH   26
+
+// FONT_KEY_GOTHIC_18_BOLD, smaller than the other system fonts
+#define FAKE_SMALL_CHAR_WIDTH    7
+#define FAKE_SMALL_LINE_HEIGHT   14
+#define FAKE_SMALL_LINE_PITCH    18
+
+#define FAKE_CUSTOM_CHAR_WIDTH   8
+#define FAKE_CUSTOM_LINE_HEIGHT  18
+#define FAKE_CUSTOM_LINE_PITCH   21
+
+// Resource id of a custom font bigger than the other ones
+#define FAKE_BIG_FONT_RESOURCE   0xb16
+#define FAKE_BIG_CHAR_WIDTH      12
+#define FAKE_BIG_LINE_HEIGHT     28
+#define FAKE_BIG_LINE_PITCH      32
+
+// Resource id whose custom font fails to load
+#define FAKE_MISSING_FONT_RESOURCE 0xdead
+
+typedef struct {
+  uint32_t layout_calls;      // graphics_text_layout_get_content_size calls
+  uint32_t text_draws;        // graphics_draw_text calls
+  uint32_t reloads;           // menu_layer_reload_data calls
+  uint32_t height_queries;    // get_cell_height and get_header_height calls
+  uint32_t logs;              // APP_LOG calls
+  uint32_t font_loads;        // custom fonts loaded
+  uint32_t invalid_destroys;  // destroys of animations already destroyed
+} FakePebbleStats;
+
+extern FakePebbleStats fake_pebble;
+
+//! Called before each SDK object is created: the creation fails when it
+//! returns true. NULL to never fail.
+extern bool (*fake_pebble_allocation_fails)(void);
+
+//! Reset the counters, the clock and the screen size to the platform default
+void fake_pebble_reset(void);
+
+//! Size of the root layer of the windows created afterwards
+void fake_pebble_set_screen_size(int16_t w, int16_t h);
+
+void fake_pebble_advance_time(uint32_t ms);
+
+//! Number of layers, windows, animations, bitmaps and custom fonts alive
+int fake_pebble_live_objects(void);
+
+Window *fake_pebble_top_window(void);
+
+//! Press a button of the top window
+void fake_pebble_click(ButtonId button);
+void fake_pebble_long_click(ButtonId button);
+
+//! Run the scheduled animations to completion, including the ones they schedule
+void fake_pebble_run_animations(void);
+
+//! Run the animations and unload the windows removed from the stack
+void fake_pebble_process_events(void);
+
+//! Draw the top window: its layers, and every section and row of its menu layers
+void fake_pebble_render(void);
+
+//! Line count of a text laid out by the fake text model in a box of a given width
+int fake_pebble_text_lines(const char *text, GFont font, int16_t width);
@@ -0,0 +1,192 @@
+#pragma once
+
+// Minimal stand-in for the Pebble SDK header, enough to build and run the
+// library on the host. The behaviour behind it lives in fake_pebble.c.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct { int16_t x; int16_t y; } GPoint;
+typedef struct { int16_t w; int16_t h; } GSize;
+typedef struct { GPoint origin; GSize size; } GRect;
+#define GRect(x, y, w, h) ((GRect){{(x), (y)}, {(w), (h)}})
+
+typedef uint8_t GColor;
+#define GColorBlack 0
+#define GColorWhite 1
+
+typedef enum {
+  GCornerNone = 0,
+  GCornersAll = 0x0f,
+} GCornerMask;
+
+typedef enum {
+  GTextOverflowModeWordWrap,
+  GTextOverflowModeTrailingEllipsis,
+  GTextOverflowModeFill,
+} GTextOverflowMode;
+
+typedef enum {
+  GTextAlignmentLeft,
+  GTextAlignmentCenter,
+  GTextAlignmentRight,
+} GTextAlignment;
+
+typedef struct GContext GContext;
+typedef struct GTextAttributes GTextAttributes;
+typedef struct GBitmap GBitmap;
+typedef struct FakeFont *GFont;
+typedef const void *ResHandle;
+
+#define FONT_KEY_GOTHIC_18_BOLD "RESOURCE_ID_GOTHIC_18_BOLD"
+#define FONT_KEY_GOTHIC_24_BOLD "RESOURCE_ID_GOTHIC_24_BOLD"
+#define FONT_KEY_GOTHIC_28_BOLD "RESOURCE_ID_GOTHIC_28_BOLD"
+
+typedef struct Layer Layer;
+typedef void (*LayerUpdateProc)(Layer *layer, GContext *ctx);
+
+typedef struct Window Window;
+typedef void (*WindowHandler)(Window *window);
+typedef struct {
+  WindowHandler load;
+  WindowHandler appear;
+  WindowHandler disappear;
+  WindowHandler unload;
+} WindowHandlers;
+
+typedef enum {
+  BUTTON_ID_BACK,
+  BUTTON_ID_UP,
+  BUTTON_ID_SELECT,
+  BUTTON_ID_DOWN,
+  NUM_BUTTONS,
+} ButtonId;
+
+typedef void *ClickRecognizerRef;
+typedef void (*ClickHandler)(ClickRecognizerRef recognizer, void *context);
+typedef void (*ClickConfigProvider)(void *context);
+
+typedef struct MenuLayer MenuLayer;
+typedef struct {
+  uint16_t section;
+  uint16_t row;
+} MenuIndex;
+
+typedef enum {
+  MenuRowAlignNone,
+  MenuRowAlignCenter,
+  MenuRowAlignTop,
+  MenuRowAlignBottom,
+} MenuRowAlign;
+
+typedef uint16_t (*MenuLayerGetNumberOfSectionsCallback)(MenuLayer *menu_layer, void *callback_context);
+typedef uint16_t (*MenuLayerGetNumberOfRowsInSectionsCallback)(MenuLayer *menu_layer, uint16_t section_index, void *callback_context);
+typedef int16_t (*MenuLayerGetCellHeightCallback)(MenuLayer *menu_layer, MenuIndex *cell_index, void *callback_context);
+typedef int16_t (*MenuLayerGetHeaderHeightCallback)(MenuLayer *menu_layer, uint16_t section_index, void *callback_context);
+typedef void (*MenuLayerDrawRowCallback)(GContext *ctx, const Layer *cell_layer, MenuIndex *cell_index, void *callback_context);
+typedef void (*MenuLayerDrawHeaderCallback)(GContext *ctx, const Layer *cell_layer, uint16_t section_index, void *callback_context);
+
+typedef struct {
+  MenuLayerGetNumberOfSectionsCallback get_num_sections;
+  MenuLayerGetNumberOfRowsInSectionsCallback get_num_rows;
+  MenuLayerGetCellHeightCallback get_cell_height;
+  MenuLayerGetHeaderHeightCallback get_header_height;
+  MenuLayerDrawRowCallback draw_row;
+  MenuLayerDrawHeaderCallback draw_header;
+} MenuLayerCallbacks;
+
+typedef struct Animation Animation;
+typedef struct Animation PropertyAnimation;
+typedef void (*AnimationStartedHandler)(Animation *animation, void *context);
+typedef void (*AnimationStoppedHandler)(Animation *animation, bool finished, void *context);
+typedef struct {
+  AnimationStartedHandler started;
+  AnimationStoppedHandler stopped;
+} AnimationHandlers;
+
+typedef enum {
+  AnimationCurveLinear,
+  AnimationCurveEaseIn,
+  AnimationCurveEaseOut,
+  AnimationCurveEaseInOut,
+} AnimationCurve;
+
+typedef enum {
+  APP_LOG_LEVEL_ERROR = 1,
+  APP_LOG_LEVEL_WARNING = 50,
+  APP_LOG_LEVEL_INFO = 100,
+  APP_LOG_LEVEL_DEBUG = 200,
+} AppLogLevel;
+
+void app_log(uint8_t log_level, const char *src_filename, int src_line_number, const char *fmt, ...);
+#define APP_LOG(level, fmt, ...) app_log(level, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
+
+uint16_t time_ms(time_t *t_utc, uint16_t *out_ms);
+
+ResHandle resource_get_handle(uint32_t resource_id);
+GFont fonts_get_system_font(const char *font_key);
+GFont fonts_load_custom_font(ResHandle handle);
+void fonts_unload_custom_font(GFont font);
+
+void graphics_context_set_fill_color(GContext *ctx, GColor color);
+void graphics_context_set_stroke_color(GContext *ctx, GColor color);
+void graphics_context_set_text_color(GContext *ctx, GColor color);
+void graphics_fill_rect(GContext *ctx, GRect rect, uint16_t corner_radius, GCornerMask corner_mask);
+void graphics_draw_rect(GContext *ctx, GRect rect);
+void graphics_fill_circle(GContext *ctx, GPoint p, uint16_t radius);
+void graphics_draw_bitmap_in_rect(GContext *ctx, const GBitmap *bitmap, GRect rect);
+void graphics_draw_text(GContext *ctx, const char *text, GFont font, GRect box,
+                        GTextOverflowMode overflow_mode, GTextAlignment alignment,
+                        GTextAttributes *text_attributes);
+GSize graphics_text_layout_get_content_size(const char *text, GFont font, GRect box,
+                                            GTextOverflowMode overflow_mode, GTextAlignment alignment);
+
+GBitmap *gbitmap_create_with_data(const uint8_t *data);
+void gbitmap_destroy(GBitmap *bitmap);
+
+Layer *layer_create(GRect frame);
+Layer *layer_create_with_data(GRect frame, size_t data_size);
+void layer_destroy(Layer *layer);
+void *layer_get_data(const Layer *layer);
+GRect layer_get_frame(const Layer *layer);
+void layer_set_frame(Layer *layer, GRect frame);
+GRect layer_get_bounds(const Layer *layer);
+void layer_set_update_proc(Layer *layer, LayerUpdateProc update_proc);
+void layer_add_child(Layer *parent, Layer *child);
+void layer_mark_dirty(Layer *layer);
+
+MenuLayer *menu_layer_create(GRect frame);
+void menu_layer_destroy(MenuLayer *menu_layer);
+Layer *menu_layer_get_layer(const MenuLayer *menu_layer);
+void menu_layer_set_callbacks(MenuLayer *menu_layer, void *callback_context, MenuLayerCallbacks callbacks);
+void menu_layer_reload_data(MenuLayer *menu_layer);
+MenuIndex menu_layer_get_selected_index(const MenuLayer *menu_layer);
+void menu_layer_set_selected_index(MenuLayer *menu_layer, MenuIndex index, MenuRowAlign scroll_align, bool animated);
+void menu_layer_set_selected_next(MenuLayer *menu_layer, bool up, MenuRowAlign scroll_align, bool animated);
+
+PropertyAnimation *property_animation_create_layer_frame(Layer *layer, GRect *from_frame, GRect *to_frame);
+void property_animation_destroy(PropertyAnimation *property_animation);
+void animation_set_duration(Animation *animation, uint32_t duration_ms);
+void animation_set_curve(Animation *animation, AnimationCurve curve);
+void animation_set_handlers(Animation *animation, AnimationHandlers callbacks, void *context);
+void animation_schedule(Animation *animation);
+void animation_unschedule(Animation *animation);
+bool animation_is_scheduled(Animation *animation);
+
+Window *window_create(void);
+void window_destroy(Window *window);
+Layer *window_get_root_layer(const Window *window);
+void window_set_user_data(Window *window, void *data);
+void *window_get_user_data(const Window *window);
+void window_set_window_handlers(Window *window, WindowHandlers handlers);
+void window_set_click_config_provider_with_context(Window *window, ClickConfigProvider click_config_provider, void *context);
+void window_set_background_color(Window *window, GColor background_color);
+void window_set_fullscreen(Window *window, bool enabled);
+void window_single_click_subscribe(ButtonId button_id, ClickHandler handler);
+void window_long_click_subscribe(ButtonId button_id, uint16_t delay_ms, ClickHandler down_handler, ClickHandler up_handler);
+void window_stack_push(Window *window, bool animated);
+bool window_stack_remove(Window *window, bool animated);
@@ -0,0 +1,1323 @@
+// Host tests of the ActionMenu, run against the fake SDK of fake_pebble.c.
+// The library is included directly so that the tests can inspect its state,
+// with its heap hooks pointed at an allocator tracking every block.
+
+#include <stdio.h>
+
+#include "fake_pebble.h"
+
+// Tracking allocator: fails the allocation number test_fail_at (counting
+// from 0) and reports frees of blocks it didn't hand out
+
+#define TEST_MAX_BLOCKS 4096
+
+static void *test_blocks[TEST_MAX_BLOCKS];
+static int test_num_blocks;
+static long test_num_allocations;
+static long test_fail_at = -1;
+static int test_bad_frees;
+
+static bool test_allocation_fails(void) {
+  return test_num_allocations++ == test_fail_at;
+}
+
+static void *test_track(void *block) {
+  if(block && test_num_blocks < TEST_MAX_BLOCKS) {
+    test_blocks[test_num_blocks++] = block;
+  }
+  return block;
+}
+
+static bool test_untrack(void *block) {
+  for(int i = 0; i < test_num_blocks; i++) {
+    if(test_blocks[i] == block) {
+      test_blocks[i] = test_blocks[--test_num_blocks];
+      return true;
+    }
+  }
+  test_bad_frees++;
+  return false;
+}
+
+static void *test_malloc(size_t size) {
+  return test_allocation_fails() ? NULL : test_track(malloc(size ? size : 1));
+}
+
+static void *test_calloc(size_t count, size_t size) {
+  return test_allocation_fails() ? NULL : test_track(calloc(count ? count : 1, size ? size : 1));
+}
+
+static void *test_realloc(void *block, size_t size) {
+  if(test_allocation_fails())
+    return NULL;
+  if(block && !test_untrack(block))
+    return NULL;
+  return test_track(realloc(block, size ? size : 1));
+}
+
+static void test_free(void *block) {
+  if(block && test_untrack(block)) {
+    free(block);
+  }
+}
+
+static void test_allocator_reset(long fail_at) {
+  test_num_allocations = 0;
+  test_fail_at = fail_at;
+  test_bad_frees = 0;
+}
+
+#define ACTION_MENU_MALLOC  test_malloc
+#define ACTION_MENU_CALLOC  test_calloc
+#define ACTION_MENU_REALLOC test_realloc
+#define ACTION_MENU_FREE    test_free
+
+#include "../src/action_menu.c"
+
+static int test_failures;
+
+#define CHECK(cond) do { \
+    if(!(cond)) { \
+      test_failures++; \
+      printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+    } \
+  } while(0)
+
+#define CHECK_EQ(actual, expected) do { \
+    long a_ = (long)(actual), e_ = (long)(expected); \
+    if(a_ != e_) { \
+      test_failures++; \
+      printf("%s:%d: CHECK_EQ(%s, %s) failed: %ld != %ld\n", __FILE__, __LINE__, #actual, #expected, a_, e_); \
+    } \
+  } while(0)
+
+//! The library and the fake SDK are back to their initial state
+static bool test_nothing_alive(void) {
+  return test_num_blocks == 0 && test_bad_frees == 0 &&
+         fake_pebble_live_objects() == 0 && fake_pebble.invalid_destroys == 0 &&
+         s_open_menus == NULL && s_num_stored_labels == 0;
+}
+
+// Callbacks recording what the menu did
+
+typedef struct {
+  int actions;
+  int long_presses;
+  int indexed_actions;
+  uint16_t last_index;
+  int confirms;
+  uint16_t last_num_selected;
+  int will_close;
+  int did_close;
+  const ActionMenuItem *did_close_action;
+  int each;
+  int each_without_label;
+} TestRecord;
+
+static TestRecord test_record;
+
+static void test_action_cb(ActionMenu *menu, const ActionMenuItem *action, void *context) {
+  test_record.actions++;
+}
+
+//! Keeps the menu open, like an action waiting for an asynchronous result
+static void test_long_press_cb(ActionMenu *menu, const ActionMenuItem *action, void *context) {
+  test_record.long_presses++;
+  action_menu_freeze(menu);
+}
+
+static void test_indexed_cb(ActionMenu *menu, const ActionMenuItem *action, uint16_t index, void *context) {
+  test_record.indexed_actions++;
+  test_record.last_index = index;
+}
+
+static void test_confirm_cb(ActionMenu *menu, const ActionMenuLevel *level, const uint8_t *selection,
+                            uint16_t num_selected, void *context) {
+  test_record.confirms++;
+  test_record.last_num_selected = num_selected;
+}
+
+static void test_will_close_cb(ActionMenu *menu, const ActionMenuItem *performed_action, void *context) {
+  test_record.will_close++;
+}
+
+static void test_did_close_cb(ActionMenu *menu, const ActionMenuItem *performed_action, void *context) {
+  test_record.did_close++;
+  test_record.did_close_action = performed_action;
+}
+
+static void test_each_cb(const ActionMenuItem *item, void *context) {
+  test_record.each++;
+  const char *label = action_menu_item_get_label(item);
+  if(label == NULL || label[0] == 0) {
+    test_record.each_without_label++;
+  }
+}
+
+static int32_t test_key_cb(const ActionMenuItem *item, void *context) {
+  const char *label = action_menu_item_get_label(item);
+  return label ? -(int32_t)strlen(label) : 0;
+}
+
+typedef struct {
+  char name[16];
+  int id;
+} TestContact;
+
+static TestContact test_contacts[] = {
+  {"Zoe", 1},
+  {"adam", 2},
+  {"Mia", 3},
+};
+
+static const char *const test_words[] = {"Delete ", "Reply ", "Open "};
+
+//! Build a hierarchy and drive an ActionMenu through every public API.
+//! Every step copes with the allocations failing, like an app should.
+static void test_scenario(void) {
+  action_menu_set_label_dictionary(test_words, 3);
+
+  ActionMenuLevel *root = action_menu_level_create(8);
+  if(root == NULL) {
+    action_menu_set_label_dictionary(NULL, 0);
+    return;
+  }
+
+  ActionMenuLevel *reply = action_menu_level_create(3);
+  if(reply) {
+    int answer = 42;
+    action_menu_level_set_inline_data_size(reply, sizeof(answer));
+    ActionMenuItem *item = action_menu_level_add_action(reply, "Reply yes", test_action_cb, &answer);
+    action_menu_item_set_long_press_action(item, test_long_press_cb);
+    action_menu_level_add_action(reply, "Reply no", test_action_cb, NULL);
+    if(action_menu_level_add_child(root, reply, "Reply ...") == NULL) {
+      CHECK(reply->parent == NULL);
+      CHECK_EQ(reply->level, 1);
+      action_menu_hierarchy_destroy(reply, test_each_cb, NULL);
+      reply = NULL;
+    }
+  }
+
+  ActionMenuLevel *pick = action_menu_level_create(4);
+  if(pick) {
+    action_menu_level_set_default_action(pick, test_indexed_cb);
+    action_menu_level_add_item(pick, "Open later");
+    action_menu_level_add_item(pick, "Delete now");
+    if(action_menu_level_add_confirm(pick, "Done", test_confirm_cb) == NULL) {
+      CHECK(pick->selection == NULL);
+      CHECK(pick->confirm_item == NULL);
+    }
+    if(action_menu_level_add_child(root, pick, "Pick") == NULL) {
+      CHECK(pick->parent == NULL);
+      CHECK_EQ(pick->level, 1);
+      action_menu_hierarchy_destroy(pick, test_each_cb, NULL);
+      pick = NULL;
+    }
+  }
+
+  ActionMenuLevel *contacts = action_menu_level_create_strided(test_contacts, 3, sizeof(TestContact),
+                                                               offsetof(TestContact, name), test_action_cb);
+  if(contacts && action_menu_level_add_child(root, contacts, "Contacts") == NULL) {
+    CHECK(contacts->parent == NULL);
+    CHECK_EQ(contacts->level, 1);
+    action_menu_hierarchy_destroy(contacts, test_each_cb, NULL);
+  }
+
+  uint16_t num_sections = root->num_sections;
+  if(!action_menu_level_add_section(root, "Mail")) {
+    CHECK_EQ(root->num_sections, num_sections);
+  }
+  action_menu_level_add_action(root, "Delete mail", test_action_cb, NULL);
+  action_menu_level_add_action(root, "archive", test_action_cb, NULL);
+  action_menu_level_add_action(root, "Open the attachment of the mail", test_action_cb, NULL);
+  action_menu_level_set_display_mode(root, ActionMenuLevelDisplayModeWide);
+  action_menu_level_sort(root, ActionMenuSortModeLabel);
+  action_menu_level_sort_by_key(reply, test_key_cb, NULL);
+  action_menu_level_sort_by_key(pick, test_key_cb, NULL);
+  action_menu_level_is_item_selected(pick, 0);
+
+  ActionMenuConfig config = {
+    .root_level = root,
+    .colors = {.background = GColorWhite, .foreground = GColorBlack},
+    .will_close = test_will_close_cb,
+    .did_close = test_did_close_cb,
+    .font = {.resource_id = 42},
+  };
+  ActionMenu *menu = action_menu_open(&config);
+  if(menu) {
+    action_menu_get_context(menu);
+    action_menu_get_root_level(menu);
+    fake_pebble_render();
+
+    // Into the first child and back
+    fake_pebble_click(BUTTON_ID_SELECT);
+    fake_pebble_run_animations();
+    fake_pebble_render();
+    fake_pebble_click(BUTTON_ID_BACK);
+    fake_pebble_run_animations();
+
+    // Into the second child: toggle an item, then reload while covered
+    fake_pebble_click(BUTTON_ID_DOWN);
+    fake_pebble_long_click(BUTTON_ID_DOWN);
+    fake_pebble_long_click(BUTTON_ID_UP);
+    fake_pebble_click(BUTTON_ID_UP);
+    fake_pebble_click(BUTTON_ID_DOWN);
+    fake_pebble_click(BUTTON_ID_SELECT);
+    fake_pebble_run_animations();
+    fake_pebble_click(BUTTON_ID_SELECT);
+    fake_pebble_render();
+
+    Window *cover = window_create();
+    if(cover) {
+      window_stack_push(cover, false);
+    }
+    action_menu_reload(menu);
+    action_menu_level_sort(root, ActionMenuSortModeLabel);
+    if(cover) {
+      window_stack_remove(cover, false);
+      window_destroy(cover);
+    }
+    fake_pebble_render();
+
+    action_menu_freeze(menu);
+    fake_pebble_click(BUTTON_ID_SELECT);
+    action_menu_unfreeze(menu);
+    action_menu_set_result_window(menu, NULL);
+#if ACTION_MENU_STATS
+    action_menu_get_session_stats(menu);
+#endif
+    fake_pebble_long_click(BUTTON_ID_SELECT);
+    action_menu_close(menu, false);
+  }
+  fake_pebble_process_events();
+
+#if ACTION_MENU_STATS
+  action_menu_get_stats();
+  action_menu_reset_stats();
+  action_menu_set_slow_callback_threshold(100);
+#endif
+  action_menu_hierarchy_destroy(root, test_each_cb, NULL);
+  action_menu_font_cache_trim();
+  action_menu_set_label_dictionary(NULL, 0);
+}
+
+static void test_scenario_without_failure(void) {
+  memset(&test_record, 0, sizeof(test_record));
+  test_allocator_reset(-1);
+  test_scenario();
+
+  CHECK(test_nothing_alive());
+  CHECK(test_num_allocations > 0);
+  CHECK_EQ(test_record.did_close, 1);
+  CHECK_EQ(test_record.will_close, 1);
+  CHECK_EQ(test_record.confirms + test_record.indexed_actions + test_record.actions + test_record.long_presses, 0);
+  // 3 + 3 + 2 + 3 items, the confirm item included
+  CHECK_EQ(test_record.each, 11);
+}
+
+//! Fail each allocation of the scenario in turn: nothing may leak nor be
+//! freed twice, and every SDK object must be destroyed
+static void test_allocation_failures(void) {
+  test_allocator_reset(-1);
+  test_scenario();
+  long num_allocations = test_num_allocations;
+
+  for(long fail_at = 0; fail_at < num_allocations; fail_at++) {
+    test_allocator_reset(fail_at);
+    test_scenario();
+    if(!test_nothing_alive()) {
+      test_failures++;
+      printf("allocation %ld failing: %d blocks leaked, %d bad frees, %d SDK objects alive\n",
+             fail_at, test_num_blocks, test_bad_frees, fake_pebble_live_objects());
+      test_num_blocks = 0;
+    }
+  }
+  printf("%ld allocation failures injected\n", num_allocations);
+}
+
+static void test_each_cb_sees_labels(void) {
+  test_allocator_reset(-1);
+  memset(&test_record, 0, sizeof(test_record));
+
+  ActionMenuLevel *root = action_menu_level_create(2);
+  ActionMenuLevel *child = action_menu_level_create(1);
+  action_menu_level_add_action(child, "Leaf", test_action_cb, NULL);
+  action_menu_level_add_child(root, child, "Child");
+  action_menu_level_add_item(root, "Compact");
+  action_menu_hierarchy_destroy(root, test_each_cb, NULL);
+
+  CHECK_EQ(test_record.each, 3);
+  CHECK_EQ(test_record.each_without_label, 0);
+  CHECK(test_nothing_alive());
+}
+
+static void test_actions(void) {
+  test_allocator_reset(-1);
+  memset(&test_record, 0, sizeof(test_record));
+
+  ActionMenuLevel *root = action_menu_level_create(3);
+  ActionMenuItem *first = action_menu_level_add_action(root, "First", test_action_cb, NULL);
+  action_menu_item_set_long_press_action(first, test_long_press_cb);
+  action_menu_level_add_item(root, "Second");
+  action_menu_level_set_default_action(root, test_indexed_cb);
+
+  ActionMenuConfig config = {.root_level = root, .did_close = test_did_close_cb};
+  ActionMenu *menu = action_menu_open(&config);
+  CHECK(menu != NULL);
+
+  // Frozen in the action: the menu stays open and ignores the buttons
+  fake_pebble_long_click(BUTTON_ID_SELECT);
+  fake_pebble_long_click(BUTTON_ID_SELECT);
+  CHECK_EQ(test_record.long_presses, 1);
+  CHECK(fake_pebble_top_window() == menu->window);
+  action_menu_unfreeze(menu);
+
+  fake_pebble_click(BUTTON_ID_DOWN);
+  fake_pebble_click(BUTTON_ID_SELECT);
+  CHECK_EQ(test_record.indexed_actions, 1);
+  CHECK_EQ(test_record.last_index, 1);
+
+  fake_pebble_process_events();
+  CHECK_EQ(test_record.did_close, 1);
+  CHECK(test_record.did_close_action == root->items[1]);
+
+  action_menu_hierarchy_destroy(root, NULL, NULL);
+  CHECK(test_nothing_alive());
+}
+
+static void test_multi_select(void) {
+  test_allocator_reset(-1);
+  memset(&test_record, 0, sizeof(test_record));
+
+  ActionMenuLevel *root = action_menu_level_create(3);
+  action_menu_level_add_action(root, "One", NULL, NULL);
+  action_menu_level_add_action(root, "Two", NULL, NULL);
+  action_menu_level_add_confirm(root, "Done", test_confirm_cb);
+
+  ActionMenuConfig config = {.root_level = root};
+  action_menu_open(&config);
+  fake_pebble_click(BUTTON_ID_SELECT);
+  fake_pebble_click(BUTTON_ID_DOWN);
+  fake_pebble_click(BUTTON_ID_SELECT);
+  fake_pebble_click(BUTTON_ID_SELECT);
+  CHECK(action_menu_level_is_item_selected(root, 0));
+  CHECK(!action_menu_level_is_item_selected(root, 1));
+
+  fake_pebble_click(BUTTON_ID_DOWN);
+  fake_pebble_click(BUTTON_ID_SELECT);
+  CHECK_EQ(test_record.confirms, 1);
+  CHECK_EQ(test_record.last_num_selected, 1);
+  CHECK(!action_menu_level_is_item_selected(root, 0));
+
+  fake_pebble_process_events();
+  action_menu_hierarchy_destroy(root, NULL, NULL);
+  CHECK(test_nothing_alive());
+}
+
+typedef struct {
+  GSize screen;
+  int16_t text_width;
+  int16_t arrow_x;
+  int16_t cell_inset;
+  GTextAlignment text_alignment;
+} TestGeometry;
+
+//! Layout computed in load_cb from the size of the window
+static void test_geometry(void) {
+  static const TestGeometry geometries[] = {
+#ifdef PBL_ROUND
+    {{180, 180}, 122, 138, 14, GTextAlignmentCenter},
+    {{260, 260}, 202, 218, 14, GTextAlignmentCenter},
+#else
+    {{144, 168}, 114, 116, 0, GTextAlignmentLeft},
+    {{200, 228}, 170, 172, 0, GTextAlignmentLeft},
+#endif
+  };
+
+  test_allocator_reset(-1);
+  ActionMenuLevel *root = action_menu_level_create(1);
+  action_menu_level_add_action(root, "Action", test_action_cb, NULL);
+
+  for(size_t i = 0; i < sizeof(geometries) / sizeof(geometries[0]); i++) {
+    const TestGeometry *geometry = &geometries[i];
+    fake_pebble_set_screen_size(geometry->screen.w, geometry->screen.h);
+
+    ActionMenuConfig config = {.root_level = root};
+    ActionMenu *menu = action_menu_open(&config);
+    CHECK_EQ(menu->layout.cell_width, geometry->screen.w - MENU_LAYER_OFFSET);
+    CHECK_EQ(menu->layout.text_width, geometry->text_width);
+    CHECK_EQ(menu->layout.arrow_x, geometry->arrow_x);
+    CHECK_EQ(menu->layout.text_max_height, geometry->screen.h);
+    CHECK_EQ(menu->layout.cell_inset, geometry->cell_inset);
+    CHECK_EQ(menu->layout.text_alignment, geometry->text_alignment);
+
+    GRect frame = layer_get_frame(menu_layer_get_layer(menu->menulayer));
+    CHECK_EQ(frame.origin.x, MENU_LAYER_OFFSET);
+    CHECK_EQ(frame.size.w, geometry->screen.w - MENU_LAYER_OFFSET);
+    CHECK_EQ(frame.size.h, geometry->screen.h);
+
+    action_menu_close(menu, false);
+    fake_pebble_process_events();
+  }
+
+  fake_pebble_reset();
+  action_menu_hierarchy_destroy(root, NULL, NULL);
+  CHECK(test_nothing_alive());
+}
+
+static bool test_level_labels_are(const ActionMenuLevel *level, const char *const *labels, uint16_t num_labels) {
+  if(level->num_items != num_labels)
+    return false;
+  for(uint16_t i = 0; i < num_labels; i++) {
+    if(strcmp(action_menu_item_get_label(level->items[i]), labels[i]) != 0) {
+      printf("item %d is \"%s\" instead of \"%s\"\n", i, action_menu_item_get_label(level->items[i]), labels[i]);
+      return false;
+    }
+  }
+  return true;
+}
+
+static int32_t test_zero_key_cb(const ActionMenuItem *item, void *context) {
+  return 0;
+}
+
+//! Labels can't be mistaken for dictionary codes, and the dictionary doesn't
+//! change under stored labels
+static void test_label_dictionary(void) {
+  static const char *const other_words[] = {"Delete "};
+
+  test_allocator_reset(-1);
+  CHECK(action_menu_set_label_dictionary(test_words, 3));
+  ActionMenuLevel *root = action_menu_level_create(3);
+  CHECK(action_menu_level_add_action(root, "Bell \x17", test_action_cb, NULL) == NULL);
+  CHECK(!action_menu_level_add_section(root, "\x10"));
+  CHECK_EQ(root->num_sections, 0);
+  CHECK(action_menu_level_add_action(root, "Reply now", test_action_cb, NULL) != NULL);
+  CHECK(action_menu_level_add_item(root, "Tab\t") != NULL);
+
+  CHECK(!action_menu_set_label_dictionary(other_words, 1));
+  CHECK(!action_menu_set_label_dictionary(NULL, 0));
+  CHECK(strcmp(action_menu_item_get_label(root->items[0]), "Reply now") == 0);
+
+  action_menu_hierarchy_destroy(root, NULL, NULL);
+  CHECK(action_menu_set_label_dictionary(NULL, 0));
+
+  // Without a dictionary the code bytes are plain characters
+  root = action_menu_level_create(1);
+  CHECK(action_menu_level_add_action(root, "Bell \x17", test_action_cb, NULL) != NULL);
+  CHECK(strcmp(action_menu_item_get_label(root->items[0]), "Bell \x17") == 0);
+  CHECK(!action_menu_set_label_dictionary(test_words, 3));
+  action_menu_hierarchy_destroy(root, NULL, NULL);
+  CHECK(test_nothing_alive());
+}
+
+static void test_sort(void) {
+  static const char *const words[] = {"Reply ", "Open "};
+  static const char *const sorted[] = {
+    "archive", "Open mail", "Reply late", "Reply later", "reply Later", "Reply soon", "A", "b",
+  };
+
+  test_allocator_reset(-1);
+  action_menu_set_label_dictionary(words, 2);
+
+  // Labels equal over the first 8 characters, compared through the dictionary
+  ActionMenuLevel *level = action_menu_level_create(8);
+  action_menu_level_add_action(level, "Reply later", test_action_cb, NULL);
+  action_menu_level_add_action(level, "Reply soon", test_action_cb, NULL);
+  action_menu_level_add_action(level, "reply Later", test_action_cb, NULL);
+  action_menu_level_add_action(level, "Open mail", test_action_cb, NULL);
+  action_menu_level_add_action(level, "Reply late", test_action_cb, NULL);
+  action_menu_level_add_action(level, "archive", test_action_cb, NULL);
+  action_menu_level_add_section(level, "Other");
+  action_menu_level_add_action(level, "b", test_action_cb, NULL);
+  action_menu_level_add_action(level, "A", test_action_cb, NULL);
+  const ActionMenuItem *later = level->items[2];
+
+  CHECK(action_menu_level_sort(level, ActionMenuSortModeLabel));
+  CHECK(test_level_labels_are(level, sorted, 8));
+  CHECK(level->items[4] == later);
+
+  // Sorting again changes nothing, nor does sorting by equal keys
+  CHECK(action_menu_level_sort(level, ActionMenuSortModeLabel));
+  CHECK(test_level_labels_are(level, sorted, 8));
+  CHECK(action_menu_level_sort_by_key(level, test_zero_key_cb, NULL));
+  CHECK(test_level_labels_are(level, sorted, 8));
+
+  action_menu_hierarchy_destroy(level, NULL, NULL);
+  action_menu_set_label_dictionary(NULL, 0);
+  CHECK(test_nothing_alive());
+}
+
+//! The confirm item stays in place and the selection follows the items
+static void test_sort_multi_select(void) {
+  static const char *const sorted[] = {"a", "b", "Done", "c"};
+
+  test_allocator_reset(-1);
+  ActionMenuLevel *level = action_menu_level_create(4);
+  action_menu_level_add_action(level, "c", NULL, NULL);
+  action_menu_level_add_action(level, "b", NULL, NULL);
+  action_menu_level_add_confirm(level, "Done", test_confirm_cb);
+  action_menu_level_add_action(level, "a", NULL, NULL);
+  level->selection[0] = 1 << 0 | 1 << 3; // "c" and "a"
+
+  ActionMenuConfig config = {.root_level = level};
+  ActionMenu *menu = action_menu_open(&config);
+  menu_layer_set_selected_index(menu->menulayer, (MenuIndex){0, 0}, MenuRowAlignCenter, false);
+
+  CHECK(action_menu_level_sort(level, ActionMenuSortModeLabel));
+  CHECK(test_level_labels_are(level, sorted, 4));
+  CHECK(level->confirm_item == level->items[2]);
+  CHECK(action_menu_level_is_item_selected(level, 0));
+  CHECK(!action_menu_level_is_item_selected(level, 1));
+  CHECK(!action_menu_level_is_item_selected(level, 2));
+  CHECK(action_menu_level_is_item_selected(level, 3));
+  // "c" is still the selected row
+  CHECK_EQ(selected_item_index(menu), 3);
+
+  CHECK(action_menu_level_sort_by_key(level, test_key_cb, NULL));
+  CHECK(level->confirm_item == level->items[2]);
+
+  action_menu_close(menu, false);
+  fake_pebble_process_events();
+  action_menu_hierarchy_destroy(level, NULL, NULL);
+  CHECK(test_nothing_alive());
+}
+
+//! Items performing the default action are identified by their index only:
+//! such levels are left unsorted
+static void test_sort_indexed_items(void) {
+  static const char *const unsorted[] = {"c", "a", "b"};
+
+  test_allocator_reset(-1);
+  ActionMenuLevel *level = action_menu_level_create(3);
+  action_menu_level_add_action(level, "c", test_action_cb, NULL);
+  action_menu_level_add_item(level, "a");
+  action_menu_level_add_item(level, "b");
+
+  // Without default action, compact items do nothing: sorting is harmless
+  CHECK(action_menu_level_sort(level, ActionMenuSortModeLabel));
+  action_menu_level_set_default_action(level, test_indexed_cb);
+  CHECK(!action_menu_level_sort(level, ActionMenuSortModeLabel));
+  CHECK(!action_menu_level_sort_by_key(level, test_key_cb, NULL));
+
+  action_menu_hierarchy_destroy(level, NULL, NULL);
+
+  // Regular actions keep their own callback: a default action doesn't matter
+  level = action_menu_level_create(3);
+  action_menu_level_set_default_action(level, test_indexed_cb);
+  for(uint8_t i = 0; i < 3; i++) {
+    action_menu_level_add_action(level, unsorted[i], test_action_cb, NULL);
+  }
+  CHECK(action_menu_level_sort(level, ActionMenuSortModeLabel));
+  CHECK(strcmp(action_menu_item_get_label(level->items[0]), "a") == 0);
+
+  action_menu_hierarchy_destroy(level, NULL, NULL);
+  CHECK(test_nothing_alive());
+}
+
+static int test_measure_calls;
+
+static int16_t test_measure_cb(const ActionMenuItem *item, int16_t width, GFont font, void *context) {
+  test_measure_calls++;
+  return 20 + 10 * strlen(action_menu_item_get_label(item));
+}
+
+typedef struct {
+  int32_t id;
+  char tag[4];
+} TestPayload;
+
+static TestPayload test_performed_payload;
+
+static void test_payload_action_cb(ActionMenu *menu, const ActionMenuItem *action, void *context) {
+  test_performed_payload = *(TestPayload *)action_menu_item_get_action_data(action);
+}
+
+static void test_payload_indexed_cb(ActionMenu *menu, const ActionMenuItem *action, uint16_t index, void *context) {
+  test_performed_payload = *(TestPayload *)action_menu_item_get_action_data(action);
+}
+
+//! Full and compact items keep a copy of their payload, freed with them
+static void test_inline_data(void) {
+  test_allocator_reset(-1);
+  ActionMenuLevel *root = action_menu_level_create(3);
+  action_menu_level_set_inline_data_size(root, sizeof(TestPayload));
+  action_menu_level_set_default_action(root, test_payload_indexed_cb);
+
+  TestPayload payload = {7, "abc"};
+  ActionMenuItem *full = action_menu_level_add_action(root, "Full", test_payload_action_cb, &payload);
+  ActionMenuItem *empty = action_menu_level_add_action(root, "Empty", test_payload_action_cb, NULL);
+  ActionMenuItem *compact = action_menu_level_add_item(root, "Compact");
+  payload.id = 8;
+
+  TestPayload *copy = action_menu_item_get_action_data(full);
+  CHECK(copy != NULL && copy != &payload);
+  CHECK_EQ(copy->id, 7);
+  CHECK(strcmp(copy->tag, "abc") == 0);
+  CHECK_EQ(((TestPayload *)action_menu_item_get_action_data(empty))->id, 0);
+
+  // Compact items get zeroed storage, filled in by the app
+  TestPayload *compact_data = action_menu_item_get_action_data(compact);
+  CHECK(compact_data != NULL);
+  CHECK_EQ(compact_data->id, 0);
+  *compact_data = (TestPayload){9, "xyz"};
+
+  ActionMenuConfig config = {.root_level = root};
+  action_menu_open(&config);
+  fake_pebble_click(BUTTON_ID_SELECT);
+  CHECK_EQ(test_performed_payload.id, 7);
+  fake_pebble_process_events();
+
+  action_menu_open(&config);
+  fake_pebble_click(BUTTON_ID_DOWN);
+  fake_pebble_click(BUTTON_ID_DOWN);
+  fake_pebble_click(BUTTON_ID_SELECT);
+  CHECK_EQ(test_performed_payload.id, 9);
+  CHECK(strcmp(test_performed_payload.tag, "xyz") == 0);
+  fake_pebble_process_events();
+
+  // Nothing left to free in an each callback
+  action_menu_hierarchy_destroy(root, NULL, NULL);
+  CHECK(test_nothing_alive());
+}
+
+typedef struct {
+  int draws;
+  int mismatched_items;
+  uint8_t checked;  // bit i set when item i was drawn checked
+  uint16_t selected_index;
+} TestDrawRecord;
+
+static TestDrawRecord test_draw_record;
+
+static void test_draw_cb(GContext *ctx, const Layer *cell_layer, const ActionMenuItem *item,
+                         const ActionMenuLevel *level, uint16_t index, bool selected,
+                         GFont font, void *context) {
+  test_draw_record.draws++;
+  if(level->items[index] != item) {
+    test_draw_record.mismatched_items++;
+  }
+  if(action_menu_level_is_item_selected(level, index)) {
+    test_draw_record.checked |= 1 << index;
+  }
+  if(selected) {
+    test_draw_record.selected_index = index;
+  }
+}
+
+//! A custom renderer can tell the checked items of a multi-select level
+static void test_custom_draw(void) {
+  test_allocator_reset(-1);
+  ActionMenuLevel *root = action_menu_level_create(4);
+  action_menu_level_add_action(root, "One", NULL, NULL);
+  action_menu_level_add_action(root, "Two", NULL, NULL);
+  action_menu_level_add_action(root, "Three", NULL, NULL);
+  action_menu_level_add_confirm(root, "Done", test_confirm_cb);
+
+  ActionMenuConfig config = {.root_level = root, .renderer = {.draw = test_draw_cb}};
+  ActionMenu *menu = action_menu_open(&config);
+  fake_pebble_click(BUTTON_ID_DOWN);
+  fake_pebble_click(BUTTON_ID_SELECT);
+  fake_pebble_click(BUTTON_ID_DOWN);
+  memset(&test_draw_record, 0, sizeof(test_draw_record));
+  fake_pebble_render();
+  CHECK_EQ(test_draw_record.draws, 4);
+  CHECK_EQ(test_draw_record.mismatched_items, 0);
+  CHECK_EQ(test_draw_record.checked, 1 << 1);
+  CHECK_EQ(test_draw_record.selected_index, 2);
+
+  action_menu_close(menu, false);
+  fake_pebble_process_events();
+  action_menu_hierarchy_destroy(root, NULL, NULL);
+  CHECK(test_nothing_alive());
+}
+
+//! Each item is measured once when its level is entered, and the levels on the
+//! way back keep their measurements
+static void test_measure_once(void) {
+  test_allocator_reset(-1);
+  ActionMenuLevel *root = action_menu_level_create(3);
+  ActionMenuLevel *child = action_menu_level_create(2);
+  action_menu_level_add_action(child, "Yes", test_action_cb, NULL);
+  action_menu_level_add_action(child, "No", test_action_cb, NULL);
+  action_menu_level_add_child(root, child, "Reply");
+  action_menu_level_add_action(root, "Delete", test_action_cb, NULL);
+  action_menu_level_add_action(root, "Archive", test_action_cb, NULL);
+
+  test_measure_calls = 0;
+  ActionMenuConfig config = {.root_level = root, .renderer = {.measure = test_measure_cb}};
+  ActionMenu *menu = action_menu_open(&config);
+  fake_pebble_render();
+  CHECK_EQ(test_measure_calls, 3);
+
+  // Into the child level, back and into it again: the child level is only
+  // cached while shown
+  for(int i = 0; i < 2; i++) {
+    fake_pebble_click(BUTTON_ID_SELECT);
+    fake_pebble_run_animations();
+    fake_pebble_render();
+    CHECK(root->cache != NULL && child->cache != NULL);
+    fake_pebble_click(BUTTON_ID_BACK);
+    fake_pebble_run_animations();
+    fake_pebble_render();
+    CHECK(child->cache == NULL);
+  }
+  CHECK_EQ(test_measure_calls, 7);
+
+  // Sorting moves the measurements along with their items
+  CHECK(action_menu_level_sort(root, ActionMenuSortModeLabel));
+  fake_pebble_render();
+  CHECK_EQ(test_measure_calls, 7);
+  for(uint16_t i = 0; i < 3; i++) {
+    CHECK_EQ(cb_get_cell_height(menu->menulayer, &(MenuIndex){0, i}, menu),
+             test_measure_cb(root->items[i], 0, NULL, NULL));
+  }
+
+  // Reloading measures the whole hierarchy again, when shown
+  test_measure_calls = 0;
+  action_menu_reload(menu);
+  fake_pebble_render();
+  CHECK_EQ(test_measure_calls, 3);
+  action_menu_close(menu, false);
+  fake_pebble_process_events();
+  CHECK(root->cache == NULL);
+
+  // The built-in measurement, with another font, doesn't reuse these heights
+  uint32_t layout_calls = fake_pebble.layout_calls;
+  config = (ActionMenuConfig){.root_level = root, .font = {.resource_id = 7}};
+  menu = action_menu_open(&config);
+  fake_pebble_render();
+  CHECK(fake_pebble.layout_calls > layout_calls);
+  for(uint16_t i = 0; i < 3; i++) {
+    const char *label = action_menu_item_get_label(root->items[i]);
+    CHECK_EQ(cb_get_cell_height(menu->menulayer, &(MenuIndex){0, i}, menu),
+             FAKE_CUSTOM_LINE_HEIGHT + (fake_pebble_text_lines(label, menu->font, menu->layout.text_width) - 1) * FAKE_CUSTOM_LINE_PITCH + 16);
+  }
+  layout_calls = fake_pebble.layout_calls;
+  fake_pebble_render();
+  CHECK_EQ(fake_pebble.layout_calls, layout_calls);
+  action_menu_close(menu, false);
+  fake_pebble_process_events();
+
+  action_menu_hierarchy_destroy(root, NULL, NULL);
+  action_menu_font_cache_trim();
+  CHECK(test_nothing_alive());
+}
+
+//! Level changes and reloads while covered do no cache work, and are applied
+//! once when the menu appears again
+static void test_refresh_while_hidden(void) {
+  test_allocator_reset(-1);
+  ActionMenuLevel *root = action_menu_level_create(2);
+  ActionMenuLevel *child = action_menu_level_create(3);
+  action_menu_level_add_action(child, "Yes", test_action_cb, NULL);
+  action_menu_level_add_action(child, "No", test_action_cb, NULL);
+  action_menu_level_add_action(child, "Maybe later, I am driving", test_action_cb, NULL);
+  action_menu_level_add_child(root, child, "Reply");
+  action_menu_level_add_action(root, "Delete", test_action_cb, NULL);
+
+  ActionMenuConfig config = {.root_level = root};
+  ActionMenu *menu = action_menu_open(&config);
+  fake_pebble_render();
+
+  // Covered in the middle of the transition to the child level
+  fake_pebble_click(BUTTON_ID_SELECT);
+  Window *cover = window_create();
+  long allocations = test_num_allocations;
+  uint32_t reloads = fake_pebble.reloads;
+  window_stack_push(cover, false);
+  CHECK(menu->current_level == child);
+  for(int i = 0; i < 3; i++) {
+    action_menu_reload(menu);
+  }
+
+  // MenuLayer may still ask for the heights of the new level
+  menu_layer_reload_data(menu->menulayer);
+  int16_t hidden_height = cb_get_cell_height(menu->menulayer, &(MenuIndex){0, 2}, menu);
+  CHECK(hidden_height >= FAKE_SYSTEM_LINE_HEIGHT + FAKE_SYSTEM_LINE_PITCH + 16);
+  CHECK_EQ(test_num_allocations, allocations);
+  CHECK_EQ(fake_pebble.reloads, reloads + 1);
+
+  window_stack_remove(cover, false);
+  window_destroy(cover);
+  CHECK_EQ(fake_pebble.reloads, reloads + 2);
+  CHECK_EQ(test_num_allocations, allocations + 1);
+  CHECK(menu_cache(menu) != NULL);
+  CHECK_EQ(cb_get_cell_height(menu->menulayer, &(MenuIndex){0, 2}, menu), hidden_height);
+  fake_pebble_render();
+
+  action_menu_close(menu, false);
+  fake_pebble_process_events();
+  action_menu_hierarchy_destroy(root, NULL, NULL);
+  CHECK(test_nothing_alive());
+}
+
+//! Labels of strided levels are the app's own strings: a dictionary set for the
+//! other levels neither decodes nor truncates them
+static void test_strided_labels(void) {
+  static struct {
+    char name[160];
+    int id;
+  } people[2] = {{"Dr \x11 Who", 1}, {"", 2}};
+  memset(people[1].name, 'w', 150);
+  for(int i = 4; i < 150; i += 5) {
+    people[1].name[i] = ' ';
+  }
+
+  test_allocator_reset(-1);
+  action_menu_set_label_dictionary(test_words, 3);
+  ActionMenuLevel *root = action_menu_level_create(1);
+  ActionMenuLevel *strided = action_menu_level_create_strided(people, 2, sizeof(people[0]),
+                                                              offsetof(__typeof__(people[0]), name),
+                                                              test_action_cb);
+  action_menu_level_add_child(root, strided, "People");
+
+  ActionMenuConfig config = {.root_level = root};
+  ActionMenu *menu = action_menu_open(&config);
+  fake_pebble_click(BUTTON_ID_SELECT);
+  fake_pebble_run_animations();
+  CHECK(menu->current_level == strided);
+  fake_pebble_render();
+
+  ActionMenuItem scratch;
+  for(uint16_t i = 0; i < 2; i++) {
+    CHECK(action_menu_item_get_label(level_get_item(strided, i, &scratch)) == people[i].name);
+  }
+  int lines = fake_pebble_text_lines(people[1].name, menu->font, menu->layout.text_width);
+  CHECK_EQ(cb_get_cell_height(menu->menulayer, &(MenuIndex){0, 1}, menu),
+           FAKE_SYSTEM_LINE_HEIGHT + (lines - 1) * FAKE_SYSTEM_LINE_PITCH + 16);
+
+  // Another menu over the same hierarchy closes: the shown level stays cached
+  ActionMenu *other = action_menu_open(&config);
+  fake_pebble_render();
+  action_menu_close(other, false);
+  fake_pebble_process_events();
+  CHECK(strided->cache != NULL);
+
+  // Once left, the strided level holds no memory
+  fake_pebble_click(BUTTON_ID_BACK);
+  fake_pebble_run_animations();
+  CHECK(strided->cache == NULL);
+  CHECK(root->cache != NULL);
+
+  action_menu_close(menu, false);
+  fake_pebble_process_events();
+  action_menu_hierarchy_destroy(root, NULL, NULL);
+  action_menu_set_label_dictionary(NULL, 0);
+  CHECK(test_nothing_alive());
+}
+
+//! Navigating again in the middle of a transition stops it: its animation is
+//! released once, whether the SDK destroys stopped animations or not
+static void test_interrupted_transitions(void) {
+  test_allocator_reset(-1);
+  ActionMenuLevel *root = action_menu_level_create(1);
+  ActionMenuLevel *child = action_menu_level_create(1);
+  action_menu_level_add_action(child, "Yes", test_action_cb, NULL);
+  action_menu_level_add_child(root, child, "Reply");
+
+  ActionMenuConfig config = {.root_level = root};
+  ActionMenu *menu = action_menu_open(&config);
+  fake_pebble_click(BUTTON_ID_SELECT);
+  fake_pebble_render();
+  fake_pebble_click(BUTTON_ID_BACK);
+  fake_pebble_render();
+  fake_pebble_run_animations();
+  fake_pebble_render();
+  CHECK(menu->prop_animation == NULL);
+  CHECK_EQ(layer_get_frame(menu->bg_layer).origin.x, 0);
+
+  // Closed during a transition
+  fake_pebble_click(BUTTON_ID_SELECT);
+  action_menu_close(menu, false);
+  fake_pebble_process_events();
+
+  action_menu_hierarchy_destroy(root, NULL, NULL);
+  CHECK(test_nothing_alive());
+}
+
+//! A font loaded at the address of an unloaded one doesn't reuse its measurements
+static void test_measure_after_font_reload(void) {
+  test_allocator_reset(-1);
+  ActionMenuLevel *root = action_menu_level_create(1);
+  action_menu_level_add_action(root, "Reply to all", test_action_cb, NULL);
+
+  ActionMenuConfig config = {.root_level = root, .font = {.resource_id = 7}};
+  ActionMenu *menu = action_menu_open(&config);
+  fake_pebble_render();
+  GFont font = menu->font;
+  action_menu_close(menu, false);
+  fake_pebble_process_events();
+  action_menu_font_cache_trim();
+
+  config.font.resource_id = FAKE_BIG_FONT_RESOURCE;
+  menu = action_menu_open(&config);
+  CHECK(menu->font == font);
+  fake_pebble_render();
+  int lines = fake_pebble_text_lines("Reply to all", menu->font, menu->layout.text_width);
+  CHECK_EQ(cb_get_cell_height(menu->menulayer, &(MenuIndex){0, 0}, menu),
+           FAKE_BIG_LINE_HEIGHT + (lines - 1) * FAKE_BIG_LINE_PITCH + 16);
+  action_menu_close(menu, false);
+  fake_pebble_process_events();
+
+  action_menu_hierarchy_destroy(root, NULL, NULL);
+  action_menu_font_cache_trim();
+  CHECK(test_nothing_alive());
+}
+
+//! The cache entry of a custom font, NULL if it isn't loaded
+static FontCacheEntry *test_cached_font(uint32_t resource_id) {
+  for(uint8_t i=0; i<FONT_CACHE_SIZE; i++) {
+    if(s_font_cache[i].font && s_font_cache[i].resource_id == resource_id) {
+      return &s_font_cache[i];
+    }
+  }
+  return NULL;
+}
+
+static ActionMenu *test_open_with_font(ActionMenuConfig *config, uint32_t resource_id) {
+  config->font.resource_id = resource_id;
+  ActionMenu *menu = action_menu_open(config);
+  fake_pebble_render();
+  return menu;
+}
+
+static void test_close(ActionMenu *menu) {
+  action_menu_close(menu, false);
+  fake_pebble_process_events();
+}
+
+//! Custom fonts are shared between the open menus, kept for the next ones
+//! until evicted or trimmed, and the system font replaces them when they
+//! can't be loaded
+static void test_font_cache(void) {
+  test_allocator_reset(-1);
+  action_menu_font_cache_trim();
+  ActionMenuLevel *root = action_menu_level_create(1);
+  action_menu_level_add_action(root, "One", test_action_cb, NULL);
+  ActionMenuConfig config = {.root_level = root};
+  GFont system_font = fonts_get_system_font(ACTION_MENU_FONT);
+  uint32_t font_loads = fake_pebble.font_loads;
+
+  // Two menus share a load of the same font
+  ActionMenu *first = test_open_with_font(&config, 1);
+  ActionMenu *second = test_open_with_font(&config, 1);
+  CHECK(first->font != system_font);
+  CHECK(second->font == first->font);
+  CHECK_EQ(test_cached_font(1)->ref_count, 2);
+  CHECK_EQ(fake_pebble.font_loads, font_loads + 1);
+
+  // Every slot is used by an open menu: the next font falls back to the
+  // system one
+  ActionMenu *third = test_open_with_font(&config, 2);
+  ActionMenu *fourth = test_open_with_font(&config, 3);
+  CHECK(third->font != system_font);
+  CHECK(fourth->font == system_font);
+  CHECK_EQ(fourth->font_load, 0);
+  CHECK(test_cached_font(3) == NULL);
+  CHECK_EQ(fake_pebble.font_loads, font_loads + 2);
+  test_close(fourth);
+  test_close(third);
+
+  // Released fonts stay loaded for the next menus
+  CHECK_EQ(test_cached_font(2)->ref_count, 0);
+  third = test_open_with_font(&config, 2);
+  CHECK_EQ(test_cached_font(2)->ref_count, 1);
+  CHECK_EQ(fake_pebble.font_loads, font_loads + 2);
+  test_close(third);
+
+  // ... until a font missing from the cache evicts them
+  third = test_open_with_font(&config, 3);
+  CHECK(test_cached_font(2) == NULL);
+  CHECK(test_cached_font(3) != NULL);
+  CHECK_EQ(fake_pebble.font_loads, font_loads + 3);
+
+  // Trimming only unloads the fonts no open menu uses
+  action_menu_font_cache_trim();
+  CHECK(test_cached_font(3) != NULL);
+  test_close(third);
+  action_menu_font_cache_trim();
+  CHECK(test_cached_font(3) == NULL);
+  CHECK(test_cached_font(1) != NULL);
+  test_close(second);
+  test_close(first);
+  action_menu_font_cache_trim();
+  CHECK(test_cached_font(1) == NULL);
+
+  // A font which fails to load is replaced by the system font
+  ActionMenu *missing = test_open_with_font(&config, FAKE_MISSING_FONT_RESOURCE);
+  CHECK(missing != NULL);
+  CHECK(missing->font == system_font);
+  CHECK_EQ(missing->font_load, 0);
+  CHECK(test_cached_font(FAKE_MISSING_FONT_RESOURCE) == NULL);
+  test_close(missing);
+
+  action_menu_hierarchy_destroy(root, NULL, NULL);
+  CHECK(test_nothing_alive());
+}
+
+static int16_t test_header_height(ActionMenu *menu, const char *label, int16_t char_width,
+                                  int16_t line_height, int16_t line_pitch) {
+  struct FakeFont font = {char_width, line_height, line_pitch};
+  int lines = fake_pebble_text_lines(label, &font, header_text_bounds(menu, GRect(0, 0, menu->layout.cell_width, 0)).size.w);
+  return line_height + (lines - 1) * line_pitch + 4;
+}
+
+static MenuIndex test_selected(ActionMenu *menu) {
+  return menu_layer_get_selected_index(menu->menulayer);
+}
+
+//! Headers are measured once in the font selected by the config, and long
+//! presses jump over the empty sections
+static void test_sections(void) {
+  test_allocator_reset(-1);
+  ActionMenuLevel *root = action_menu_level_create(4);
+  action_menu_level_add_action(root, "Top", test_action_cb, NULL);
+  action_menu_level_add_section(root, "Mail");
+  action_menu_level_add_action(root, "Reply", test_action_cb, NULL);
+  action_menu_level_add_action(root, "Forward", test_action_cb, NULL);
+  action_menu_level_add_section(root, "Empty");
+  action_menu_level_add_section(root, "Phone");
+  action_menu_level_add_action(root, "Call", test_action_cb, NULL);
+
+  ActionMenuConfig config = {.root_level = root};
+  ActionMenu *menu = action_menu_open(&config);
+  fake_pebble_render();
+  CHECK_EQ(cb_get_num_sections(menu->menulayer, menu), 4);
+  CHECK_EQ(cb_get_header_height(menu->menulayer, 0, menu), 0);
+  CHECK_EQ(cb_get_header_height(menu->menulayer, 1, menu),
+           test_header_height(menu, "Mail", FAKE_SMALL_CHAR_WIDTH, FAKE_SMALL_LINE_HEIGHT, FAKE_SMALL_LINE_PITCH));
+  CHECK_EQ(root->cache->header_heights[1], cb_get_header_height(menu->menulayer, 1, menu));
+
+  // Drawing again asks for every height and measures nothing
+  uint32_t height_queries = fake_pebble.height_queries;
+  uint32_t layout_calls = fake_pebble.layout_calls;
+  fake_pebble_render();
+  CHECK(fake_pebble.height_queries > height_queries);
+  CHECK_EQ(fake_pebble.layout_calls, layout_calls);
+
+  // Sections without items are skipped
+  fake_pebble_long_click(BUTTON_ID_DOWN);
+  CHECK_EQ(test_selected(menu).section, 1);
+  CHECK_EQ(test_selected(menu).row, 0);
+  fake_pebble_long_click(BUTTON_ID_DOWN);
+  CHECK_EQ(test_selected(menu).section, 3);
+  fake_pebble_long_click(BUTTON_ID_DOWN);
+  CHECK_EQ(test_selected(menu).section, 3);
+  fake_pebble_long_click(BUTTON_ID_UP);
+  CHECK_EQ(test_selected(menu).section, 1);
+  // Up from a later item goes to the first one of its section
+  fake_pebble_click(BUTTON_ID_DOWN);
+  CHECK_EQ(test_selected(menu).row, 1);
+  fake_pebble_long_click(BUTTON_ID_UP);
+  CHECK_EQ(test_selected(menu).section, 1);
+  CHECK_EQ(test_selected(menu).row, 0);
+
+  // A menu selecting a font uses it for the headers too, even with the same
+  // item font: the measurements of the shared level are redone for it
+  config.font.system_key = ACTION_MENU_FONT;
+  ActionMenu *selected_font = action_menu_open(&config);
+  fake_pebble_render();
+  CHECK(selected_font->font == menu->font);
+  CHECK_EQ(cb_get_header_height(selected_font->menulayer, 1, selected_font),
+           test_header_height(selected_font, "Mail", FAKE_SYSTEM_CHAR_WIDTH, FAKE_SYSTEM_LINE_HEIGHT, FAKE_SYSTEM_LINE_PITCH));
+  CHECK_EQ(root->cache->header_heights[1], cb_get_header_height(selected_font->menulayer, 1, selected_font));
+  action_menu_close(selected_font, false);
+  fake_pebble_process_events();
+  fake_pebble_render();
+  CHECK_EQ(root->cache->header_heights[1],
+           test_header_height(menu, "Mail", FAKE_SMALL_CHAR_WIDTH, FAKE_SMALL_LINE_HEIGHT, FAKE_SMALL_LINE_PITCH));
+  action_menu_close(menu, false);
+  fake_pebble_process_events();
+  action_menu_hierarchy_destroy(root, NULL, NULL);
+  CHECK(test_nothing_alive());
+}
+
+//! Long presses are only subscribed by menus with sections somewhere in their
+//! hierarchy, and move by one item in the levels without sections
+static void test_long_clicks_need_sections(void) {
+  test_allocator_reset(-1);
+  ActionMenuLevel *root = action_menu_level_create(3);
+  action_menu_level_add_action(root, "One", test_action_cb, NULL);
+  action_menu_level_add_action(root, "Two", test_action_cb, NULL);
+
+  ActionMenuConfig config = {.root_level = root};
+  ActionMenu *menu = action_menu_open(&config);
+  fake_pebble_long_click(BUTTON_ID_DOWN);
+  CHECK_EQ(selected_item_index(menu), 0);
+  action_menu_close(menu, false);
+  fake_pebble_process_events();
+
+  ActionMenuLevel *child = action_menu_level_create(2);
+  action_menu_level_add_section(child, "Later");
+  action_menu_level_add_action(child, "Leaf", test_action_cb, NULL);
+  action_menu_level_add_child(root, child, "Child");
+  menu = action_menu_open(&config);
+  fake_pebble_long_click(BUTTON_ID_DOWN);
+  CHECK_EQ(selected_item_index(menu), 1);
+  action_menu_close(menu, false);
+  fake_pebble_process_events();
+
+  action_menu_hierarchy_destroy(root, NULL, NULL);
+  CHECK(test_nothing_alive());
+}
+
+#if ACTION_MENU_STATS
+//! Takes 150 ms, above the default slow callback threshold
+static void test_slow_action_cb(ActionMenu *menu, const ActionMenuItem *action, void *context) {
+  fake_pebble_advance_time(150);
+}
+
+static void test_slow_each_cb(const ActionMenuItem *item, void *context) {
+  fake_pebble_advance_time(150);
+}
+
+//! Latencies land in the bucket of their duration and slow callbacks are
+//! counted and logged
+static void test_latency_stats(void) {
+  test_allocator_reset(-1);
+  action_menu_reset_stats();
+  action_menu_set_slow_callback_threshold(100);
+
+  ActionMenuLevel *root = action_menu_level_create(2);
+  ActionMenuLevel *child = action_menu_level_create(1);
+  action_menu_level_add_action(child, "Leaf", test_action_cb, NULL);
+  action_menu_level_add_child(root, child, "Child");
+  action_menu_level_add_action(root, "Slow", test_slow_action_cb, NULL);
+
+  ActionMenuConfig config = {.root_level = root};
+  action_menu_open(&config);
+  fake_pebble_render();
+  const ActionMenuStats *stats = action_menu_get_stats();
+
+  // 40 ms from the press to the frame: 32 <= 40 < 64
+  fake_pebble_click(BUTTON_ID_DOWN);
+  fake_pebble_advance_time(40);
+  fake_pebble_render();
+  CHECK_EQ(stats->click_to_redraw.buckets[2], 1);
+  // Only the first frame after a press counts
+  fake_pebble_render();
+  CHECK_EQ(stats->click_to_redraw.buckets[0] + stats->click_to_redraw.buckets[2], 1);
+
+  // 20 ms from BACK to the end of the transitions: 16 <= 20 < 32
+  fake_pebble_click(BUTTON_ID_UP);
+  fake_pebble_click(BUTTON_ID_SELECT);
+  fake_pebble_run_animations();
+  fake_pebble_click(BUTTON_ID_BACK);
+  fake_pebble_advance_time(20);
+  fake_pebble_run_animations();
+  CHECK_EQ(stats->back_to_level_shown.buckets[1], 1);
+  CHECK_EQ(stats->slow_callbacks, 0);
+
+  // 150 ms in the action: 128 <= 150 < 256
+  uint32_t logs = fake_pebble.logs;
+  fake_pebble_click(BUTTON_ID_DOWN);
+  fake_pebble_click(BUTTON_ID_SELECT);
+  CHECK_EQ(stats->select_to_action_done.buckets[4], 1);
+  CHECK_EQ(stats->slow_callbacks, 1);
+  CHECK_EQ(stats->slowest_callback_ms, 150);
+  CHECK_EQ(fake_pebble.logs, logs + 1);
+  fake_pebble_process_events();
+
+  // A threshold of 0 disables the warnings
+  action_menu_set_slow_callback_threshold(0);
+  action_menu_hierarchy_destroy(root, test_slow_each_cb, NULL);
+  CHECK_EQ(stats->slow_callbacks, 1);
+  CHECK_EQ(fake_pebble.logs, logs + 1);
+  CHECK(test_nothing_alive());
+
+  action_menu_reset_stats();
+  CHECK_EQ(stats->select_to_action_done.buckets[4], 0);
+  CHECK_EQ(stats->slow_callbacks, 0);
+  action_menu_set_slow_callback_threshold(100);
+}
+
+static ActionMenuSessionStats test_session;
+
+static void test_session_did_close_cb(ActionMenu *menu, const ActionMenuItem *performed_action, void *context) {
+  test_session = *action_menu_get_session_stats(menu);
+}
+
+//! The session counters of two menus, the heap operations of the SDK objects
+//! included
+static void test_session_stats(void) {
+  test_allocator_reset(-1);
+
+  ActionMenuLevel *root = action_menu_level_create(2);
+  action_menu_level_add_action(root, "One", test_action_cb, NULL);
+  ActionMenuConfig config = {.root_level = root, .did_close = test_session_did_close_cb};
+
+  action_menu_open(&config);
+  fake_pebble_render();
+  fake_pebble_advance_time(500);
+  fake_pebble_click(BUTTON_ID_BACK);
+  fake_pebble_process_events();
+  CHECK_EQ(test_session.frames, 1);
+  CHECK_EQ(test_session.animation_frames, 0);
+  CHECK_EQ(test_session.text_draws, 1);
+  CHECK_EQ(test_session.text_measurements, 1);
+  CHECK_EQ(test_session.on_screen_ms, 500);
+  // The menu, its config and its cache, then a window and 3 layers created
+  // and destroyed, then the cache freed
+  CHECK_EQ(test_session.heap_operations, 3 + 8 + 1);
+
+  // Into a child and back: 2 animations created and released each way, the
+  // cache of the child and the arrow bitmap allocated and freed
+  ActionMenuLevel *child = action_menu_level_create(1);
+  action_menu_level_add_action(child, "Leaf", test_action_cb, NULL);
+  action_menu_level_add_child(root, child, "Child");
+  action_menu_open(&config);
+  fake_pebble_render();
+  fake_pebble_click(BUTTON_ID_DOWN);
+  fake_pebble_click(BUTTON_ID_SELECT);
+  fake_pebble_render();
+  fake_pebble_run_animations();
+  fake_pebble_click(BUTTON_ID_BACK);
+  fake_pebble_run_animations();
+  fake_pebble_click(BUTTON_ID_BACK);
+  fake_pebble_process_events();
+  CHECK_EQ(test_session.frames, 2);
+  CHECK_EQ(test_session.animation_frames, 1);
+  CHECK_EQ(test_session.heap_operations, 3 + 8 + 1 + 8 + 2 + 2);
+
+  action_menu_hierarchy_destroy(root, NULL, NULL);
+  CHECK(test_nothing_alive());
+}
+#endif
+
+int main(void) {
+  fake_pebble_reset();
+  fake_pebble_allocation_fails = test_allocation_fails;
+
+  test_each_cb_sees_labels();
+  test_actions();
+  test_multi_select();
+  test_interrupted_transitions();
+  test_geometry();
+  test_label_dictionary();
+  test_sort();
+  test_sort_multi_select();
+  test_sort_indexed_items();
+  test_inline_data();
+  test_custom_draw();
+  test_measure_once();
+  test_measure_after_font_reload();
+  test_font_cache();
+  test_sections();
+  test_long_clicks_need_sections();
+  test_refresh_while_hidden();
+  test_strided_labels();
+#if ACTION_MENU_STATS
+  test_latency_stats();
+  test_session_stats();
+#endif
+  test_scenario_without_failure();
+  test_allocation_failures();
+
+  if(test_failures) {
+    printf("%d check(s) failed\n", test_failures);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}